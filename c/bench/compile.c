@@ -0,0 +1,92 @@
+// Measures how compile time scales with program size, on synthetic programs with `n` functions and a
+// `main` that has `n` locals, each initialized to a distinct constant. If looking up globals, locals,
+// or constants is linear, the time per function grows with `n` rather than staying flat.
+//
+// usage: ./bench_compile [smallest n] [largest n]
+#include "../src/value.h"
+#include "../src/compile.h"
+#include "../src/environment.h"
+#include "../src/globals.h"
+#include "../src/builtin_function.h"
+#include "../src/shared.h"
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+static struct {
+	size_t length, capacity;
+	char *source;
+} program;
+
+static void append(const char *fmt, ...) {
+	va_list args;
+
+	while (true) {
+		va_start(args, fmt);
+		size_t available = program.capacity - program.length;
+		int written = vsnprintf(program.source + program.length, available, fmt, args);
+		va_end(args);
+
+		if ((size_t) written < available) {
+			program.length += written;
+			return;
+		}
+
+		program.capacity *= 2;
+		program.source = xrealloc(program.source, program.capacity);
+	}
+}
+
+static void generate_program(unsigned n) {
+	program.length = 0;
+
+	for (unsigned i = 0; i < n; i++)
+		append("function f%u(a) { return a + %u; }\n", i, i);
+
+	append("function main() {\n");
+	for (unsigned i = 0; i < n; i++)
+		append("\tlocal v%u = %u;\n", i, i);
+	append("}\n");
+}
+
+int main(int argc, char **argv) {
+	if (argc > 3)
+		die("usage: %s [smallest n] [largest n]", argv[0]);
+
+	unsigned smallest = argc >= 2 ? (unsigned) atoi(argv[1]) : 10000;
+	unsigned largest = argc == 3 ? (unsigned) atoi(argv[2]) : 80000;
+
+	if (smallest == 0 || largest < smallest)
+		die("the sizes must be positive, and the largest can't be smaller than the smallest");
+
+	init_environment();
+	init_builtin_functions();
+
+	program.capacity = 4096;
+	program.source = xmalloc(program.capacity);
+
+	for (unsigned n = smallest; n <= largest; n *= 2) {
+		generate_program(n);
+		init_global_variables();
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		compile("bench", program.source, program.length);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("n = %6u: %8zu bytes in %.3fs, %.0f ns per function\n",
+			n, program.length, seconds, seconds * 1e9 / n);
+
+		free_global_variables();
+
+		// The sizes would never stop doubling otherwise.
+		if (n > largest / 2)
+			break;
+	}
+
+	free(program.source);
+	free_modules();
+	free_environment();
+	return 0;
+}
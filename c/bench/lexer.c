@@ -0,0 +1,53 @@
+// Measures how quickly the tokenizer gets through a file, in MB/s.
+//
+// usage: ./bench_lexer filename [iterations]
+#include "../src/token.h"
+#include "../src/value.h"
+#include "../src/shared.h"
+#include "../src/environment.h"
+#include <string.h>
+#include <time.h>
+
+int main(int argc, char **argv) {
+	if (argc != 2 && argc != 3)
+		die("usage: %s filename [iterations]", argv[0]);
+
+	init_environment();
+
+	file_contents contents = read_file(argv[1]);
+	size_t length = contents.length;
+	unsigned iterations = argc == 3 ? (unsigned) atoi(argv[2]) : 10;
+	unsigned long number_of_tokens = 0;
+	unsigned lines = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned i = 0; i < iterations; i++) {
+		tokenizer tzr = new_tokenizer(argv[1], contents.ptr);
+		tzr.end = contents.ptr + contents.length;
+		token tkn;
+
+		while ((tkn = next_token(&tzr)).kind != TOKEN_KIND_UNDEFINED) {
+			if (tkn.kind == TOKEN_KIND_LITERAL)
+				free_value(tkn.val);
+
+			number_of_tokens++;
+		}
+
+		lines = tzr.line_number;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	double megabytes = (double) length * iterations / (1024 * 1024);
+
+	printf("%s: %zu bytes, %u lines, %lu tokens per pass\n",
+		argv[1], length, lines, number_of_tokens / iterations);
+	printf("%u passes in %.3fs: %.1f MB/s\n", iterations, seconds, megabytes / seconds);
+
+	free_file_contents(contents);
+	free_environment();
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include "arena.h"
+#include "shared.h"
+#include <string.h>
+
+struct arena_chunk {
+	arena_chunk *next;
+	size_t size;
+	_Alignas(8) char memory[];
+};
+
+#define ALIGN_UP(size) (((size) + 7) & ~(size_t) 7)
+
+arena new_arena(void) {
+	return (arena) { .chunks = NULL, .bump = NULL, .end = NULL, .last = NULL };
+}
+
+static void add_chunk(arena *arena, size_t minimum_size) {
+	size_t size = minimum_size < ARENA_CHUNK_SIZE ? ARENA_CHUNK_SIZE : minimum_size;
+	arena_chunk *chunk = xmalloc(sizeof(arena_chunk) + size);
+
+	chunk->next = arena->chunks;
+	chunk->size = size;
+	arena->chunks = chunk;
+	arena->bump = chunk->memory;
+	arena->end = chunk->memory + size;
+}
+
+void *arena_alloc(arena *arena, size_t size) {
+	size = ALIGN_UP(size);
+
+	if ((size_t) (arena->end - arena->bump) < size)
+		add_chunk(arena, size);
+
+	arena->last = arena->bump;
+	arena->bump += size;
+	return arena->last;
+}
+
+void *arena_realloc(arena *arena, void *ptr, size_t old_size, size_t new_size) {
+	if (ptr != NULL && ptr == arena->last && (size_t) (arena->end - (char *) ptr) >= ALIGN_UP(new_size)) {
+		arena->bump = (char *) ptr + ALIGN_UP(new_size);
+		return ptr;
+	}
+
+	void *new_ptr = arena_alloc(arena, new_size);
+	if (ptr != NULL)
+		memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+
+	return new_ptr;
+}
+
+arena_position save_arena(const arena *arena) {
+	return (arena_position) { .chunk = arena->chunks, .bump = arena->bump };
+}
+
+void restore_arena(arena *arena, arena_position position) {
+	while (arena->chunks != position.chunk) {
+		arena_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+
+	arena->bump = position.bump;
+	arena->end = position.chunk == NULL ? NULL : position.chunk->memory + position.chunk->size;
+	arena->last = NULL;
+}
+
+void reset_arena(arena *arena) {
+	if (arena->chunks == NULL)
+		return;
+
+	// Only keep the oldest chunk, as later ones are usually from unusually large declarations.
+	while (arena->chunks->next != NULL) {
+		arena_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+
+	arena->bump = arena->chunks->memory;
+	arena->end = arena->chunks->memory + arena->chunks->size;
+	arena->last = NULL;
+}
+
+void free_arena(arena *arena) {
+	while (arena->chunks != NULL) {
+		arena_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+
+	*arena = new_arena();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+
+// A bump allocator for data which all dies at the same time (such as the AST of a declaration).
+// Allocations are carved sequentially out of chunks, and can't be freed individually; instead, the
+// whole arena is released in one go with `reset_arena` or `free_arena`.
+
+#ifndef ARENA_CHUNK_SIZE
+# define ARENA_CHUNK_SIZE (16 * 1024)
+#endif
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct {
+	arena_chunk *chunks; // The most recently allocated chunk is first.
+	char *bump, *end; // The unused part of the first chunk.
+	void *last; // The most recent allocation, which `arena_realloc` can grow in place.
+} arena;
+
+arena new_arena(void);
+void *arena_alloc(arena *arena, size_t size);
+
+// Like `realloc`, except `old_size` must be given. If `ptr` was the last allocation, and there's room
+// for it, it's grown in place.
+void *arena_realloc(arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+// A point in an arena that it can later be rewound to, releasing everything allocated since then.
+typedef struct {
+	arena_chunk *chunk;
+	char *bump;
+} arena_position;
+
+arena_position save_arena(const arena *arena);
+void restore_arena(arena *arena, arena_position position);
+
+// Releases everything allocated from `arena`, keeping its first chunk around for reuse.
+void reset_arena(arena *arena);
+void free_arena(arena *arena);
@@ -1,46 +1,301 @@
 #include <assert.h>
+#include <string.h>
 
 #include "array.h"
 #include "shared.h"
+#include "pool.h"
 #include "value.h"
+#include "kernels.h"
 
-array *new_array(value *elements, unsigned length, unsigned capacity) {
+// Numbers and values are the same size, so code that just moves elements around can treat them
+// alike (and numbers arrays can be converted to values arrays in place).
+_Static_assert(sizeof(number) == sizeof(value), "numbers and values must be the same size");
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long long))
+
+array *new_array(array_strategy strategy, void *elements, unsigned length, unsigned capacity) {
 	assert(length <= capacity);
-	array *ary = xmalloc(sizeof(array));
+	array *ary = pool_alloc(sizeof(array));
 
 	ary->refcount = 1;
 	ary->length = length;
 	ary->capacity = capacity;
 	ary->elements = elements;
+	ary->strategy = strategy;
+	ary->parent = NULL;
 
 	return ary;
 }
 
+// Returns how many bytes `capacity` elements take up when stored with `strategy`.
+static size_t storage_size(array_strategy strategy, unsigned capacity) {
+	switch (strategy) {
+	case ARRAY_STRATEGY_EMPTY: return 0;
+	case ARRAY_STRATEGY_NUMBERS: return capacity * sizeof(number);
+	case ARRAY_STRATEGY_BOOLEANS: return capacity / 8; // It's always a multiple of `BITS_PER_WORD`.
+	case ARRAY_STRATEGY_VALUES: return capacity * sizeof(value);
+	default: bug("unknown array strategy %d", strategy);
+	}
+}
+
+static bool get_bit(const array *ary, unsigned idx) {
+	return (ary->bits[idx / BITS_PER_WORD] >> (idx % BITS_PER_WORD)) & 1;
+}
+
+static void set_bit(array *ary, unsigned idx, bool bit) {
+	unsigned long long mask = 1ULL << (idx % BITS_PER_WORD);
+
+	if (bit)
+		ary->bits[idx / BITS_PER_WORD] |= mask;
+	else
+		ary->bits[idx / BITS_PER_WORD] &= ~mask;
+}
+
+// Returns the element at `idx` (which must be in bounds), without cloning it.
+static value element_at(const array *ary, unsigned idx) {
+	assert(idx < ary->length);
+
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_NUMBERS: return new_number_value(ary->numbers[idx]);
+	case ARRAY_STRATEGY_BOOLEANS: return new_boolean_value(get_bit(ary, idx));
+	case ARRAY_STRATEGY_VALUES: return ary->values[idx];
+	default: bug("element of array with strategy %d", ary->strategy);
+	}
+}
+
+// Stores `val` at `idx` (which must be within `ary`'s capacity), without freeing what was there.
+// `ary` must be able to hold `val`.
+static void store_element(array *ary, unsigned idx, value val) {
+	assert(idx < ary->capacity);
+
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_NUMBERS: ary->numbers[idx] = as_number(val); break;
+	case ARRAY_STRATEGY_BOOLEANS: set_bit(ary, idx, val == VALUE_TRUE); break;
+	case ARRAY_STRATEGY_VALUES: ary->values[idx] = val; break;
+	default: bug("store into array with strategy %d", ary->strategy);
+	}
+}
+
+// Returns the most specific strategy that can hold `val`.
+static array_strategy strategy_for(value val) {
+	if (is_number(val))
+		return ARRAY_STRATEGY_NUMBERS;
+
+	if (is_boolean(val))
+		return ARRAY_STRATEGY_BOOLEANS;
+
+	return ARRAY_STRATEGY_VALUES;
+}
+
+// Bitsets are allocated a whole number of words at a time.
+static unsigned round_capacity(array_strategy strategy, unsigned capacity) {
+	if (strategy == ARRAY_STRATEGY_BOOLEANS)
+		capacity = (capacity + BITS_PER_WORD - 1) / BITS_PER_WORD * BITS_PER_WORD;
+
+	return capacity;
+}
+
 void deallocate_array(array *ary) {
 	assert(ary->refcount == 0);
 
-	for (unsigned i = 0; i < ary->length; i++)
-		free_value(ary->elements[i]);
+	// The elements of slices are owned by their storage array.
+	if (ary->parent != NULL) {
+		free_array(ary->parent);
+		pool_free(ary, sizeof(array));
+		return;
+	}
+
+	// Only arrays of values have elements that need freeing.
+	if (ary->strategy == ARRAY_STRATEGY_VALUES) {
+		for (unsigned i = 0; i < ary->length; i++)
+			free_value(ary->values[i]);
+	}
+
+	pool_free(ary->elements, storage_size(ary->strategy, ary->capacity));
+	pool_free(ary, sizeof(array));
+}
 
-	free(ary->elements);
-	free(ary);
+// Gives the empty array `ary` the strategy `strategy`, allocating the capacity it was created with
+// (or 4, if it was created without one).
+static void adopt_strategy(array *ary, array_strategy strategy) {
+	assert(ary->strategy == ARRAY_STRATEGY_EMPTY && ary->elements == NULL);
+
+	unsigned capacity = round_capacity(strategy, ary->capacity == 0 ? 4 : ary->capacity);
+
+	ary->strategy = strategy;
+	ary->capacity = capacity;
+	ary->elements = pool_alloc(storage_size(strategy, capacity));
 }
 
-static void reallocate_if_necessary(array *ary) {
+// Converts `ary` to `ARRAY_STRATEGY_VALUES`, so that it can hold any value.
+static void generalize_array(array *ary) {
+	assert(ary->parent == NULL);
+
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_VALUES:
+		return;
+
+	case ARRAY_STRATEGY_EMPTY:
+		adopt_strategy(ary, ARRAY_STRATEGY_VALUES);
+		return;
+
+	case ARRAY_STRATEGY_NUMBERS:
+		// Numbers and values are the same size, so they can just be boxed where they are.
+		for (unsigned i = 0; i < ary->length; i++)
+			ary->values[i] = new_number_value(ary->numbers[i]);
+		break;
+
+	case ARRAY_STRATEGY_BOOLEANS: {
+		// Bitsets have their capacity rounded up to a whole word, which is a lot of values.
+		unsigned capacity = ary->length < 4 ? 4 : ary->length;
+		value *values = pool_alloc(capacity * sizeof(value));
+
+		for (unsigned i = 0; i < ary->length; i++)
+			values[i] = new_boolean_value(get_bit(ary, i));
+
+		pool_free(ary->bits, storage_size(ARRAY_STRATEGY_BOOLEANS, ary->capacity));
+		ary->values = values;
+		ary->capacity = capacity;
+		break;
+	}
+	}
+
+	ary->strategy = ARRAY_STRATEGY_VALUES;
+}
+
+// Makes sure `ary` has room for `amount` more elements, growing its capacity geometrically.
+static void reserve_array(array *ary, unsigned amount) {
+	assert(ary->parent == NULL && ary->strategy != ARRAY_STRATEGY_EMPTY);
 	assert(ary->length <= ary->capacity); // It makes no sense to have more elements than capacity.
 
-	if (ary->capacity != ary->length)
+	if (ary->length + amount <= ary->capacity)
 		return;
 
-	// If `ary` is initially an empty array, start off with a capacity of 4. Otherwise, double it.
-	ary->capacity = (ary->capacity == 0) ? 4 : ary->capacity * 2;
-	ary->elements = xrealloc(ary->elements, ary->capacity * sizeof(value));
+	// Double the capacity, unless that's still not enough.
+	unsigned new_capacity = ary->capacity == 0 ? 4 : ary->capacity * 2;
+	if (new_capacity < ary->length + amount)
+		new_capacity = ary->length + amount;
+	new_capacity = round_capacity(ary->strategy, new_capacity);
+
+	ary->elements = pool_realloc(
+		ary->elements,
+		storage_size(ary->strategy, ary->capacity),
+		storage_size(ary->strategy, new_capacity)
+	);
+	ary->capacity = new_capacity;
+}
+
+// Appends clones of the `length` elements of `src` starting at `start` to `dst`, converting `dst` to
+// a more general strategy if need be. `dst` mustn't be sharing its elements.
+static void append_elements(array *dst, const array *src, unsigned start, unsigned length) {
+	if (length == 0)
+		return;
+
+	if (dst->strategy == ARRAY_STRATEGY_EMPTY)
+		adopt_strategy(dst, src->strategy);
+	else if (dst->strategy != src->strategy)
+		generalize_array(dst);
+
+	reserve_array(dst, length);
+
+	switch (dst->strategy) {
+	case ARRAY_STRATEGY_NUMBERS:
+		memcpy(dst->numbers + dst->length, src->numbers + start, length * sizeof(number));
+		break;
+
+	case ARRAY_STRATEGY_BOOLEANS:
+		for (unsigned i = 0; i < length; i++)
+			set_bit(dst, dst->length + i, get_bit(src, start + i));
+		break;
+
+	default:
+		for (unsigned i = 0; i < length; i++)
+			dst->values[dst->length + i] = clone_value(element_at(src, start + i));
+	}
+
+	dst->length += length;
+}
+
+array *slice_array(array *ary, unsigned start, unsigned length) {
+	assert(start <= ary->length && length <= ary->length - start);
+
+	// Bitsets can't point into the middle of a word, but they're very cheap to copy anyways.
+	if (length < ARRAY_SLICE_MIN_LENGTH || ary->strategy == ARRAY_STRATEGY_BOOLEANS) {
+		array *ret = allocate_array(length);
+		append_elements(ret, ary, start, length);
+		return ret;
+	}
+
+	// Move `ary`'s elements into a storage array, making `ary` a slice of all of it.
+	if (ary->parent == NULL) {
+		ary->parent = new_array(ary->strategy, ary->elements, ary->length, ary->capacity);
+		ary->capacity = ary->length;
+	}
+
+	array *slice = new_array(ary->strategy, ary->values + start, length, length);
+	slice->parent = clone_array(ary->parent);
+	return slice;
+}
+
+// Gives `ary` its own elements if it's sharing them with slices, so that it can be modified.
+static void unshare_array(array *ary) {
+	array *storage = ary->parent;
+
+	if (storage == NULL)
+		return;
+
+	ary->parent = NULL;
+
+	// If nothing else is using the storage, we can just take its elements instead of copying them.
+	if (storage->refcount == 1) {
+		unsigned start = ary->values - storage->values;
+
+		if (storage->strategy == ARRAY_STRATEGY_VALUES) {
+			for (unsigned i = 0; i < start; i++)
+				free_value(storage->values[i]);
+
+			for (unsigned i = start + ary->length; i < storage->length; i++)
+				free_value(storage->values[i]);
+		}
+
+		memmove(storage->values, ary->values, ary->length * sizeof(value));
+		ary->elements = storage->elements;
+		ary->capacity = storage->capacity;
+
+		pool_free(storage, sizeof(array));
+		return;
+	}
+
+	value *elements = pool_alloc(ary->length * sizeof(value));
+
+	if (ary->strategy == ARRAY_STRATEGY_VALUES) {
+		for (unsigned i = 0; i < ary->length; i++)
+			elements[i] = clone_value(ary->values[i]);
+	} else {
+		memcpy(elements, ary->elements, ary->length * sizeof(value));
+	}
+
+	ary->values = elements;
+	ary->capacity = ary->length;
+	free_array(storage);
+}
+
+// Gets `ary` ready to have `val` stored in it, unsharing its elements and generalizing its strategy
+// if need be.
+static void prepare_to_store(array *ary, value val) {
+	unshare_array(ary);
+
+	if (ary->strategy == ARRAY_STRATEGY_EMPTY)
+		adopt_strategy(ary, strategy_for(val));
+	else if (ary->strategy != strategy_for(val))
+		generalize_array(ary);
 }
 
 void push_array(array *ary, value val) {
-	reallocate_if_necessary(ary);
+	prepare_to_store(ary, val);
+	reserve_array(ary, 1);
 
-	ary->elements[ary->length] = val;
+	store_element(ary, ary->length, val);
 	ary->length++;
 }
 
@@ -48,9 +303,10 @@ value pop_array(array *ary) {
 	if (ary->length == 0)
 		return VALUE_UNDEFINED;
 
-	value ret = ary->elements[ary->length];
+	unshare_array(ary);
+
 	ary->length--;
-	return ret; // No need to clone, as we now own it.
+	return element_at(ary, ary->length); // No need to clone, as we now own it.
 }
 
 value index_array(const array *ary, int idx) {
@@ -66,7 +322,7 @@ value index_array(const array *ary, int idx) {
 	if (ary->length <= (unsigned) idx)
 		return VALUE_UNDEFINED;
 
-	return clone_value(ary->elements[idx]); // Clone it as we still have ownership of the original.
+	return clone_value(element_at(ary, idx)); // Clone it as we still have ownership of the original.
 }
 
 bool index_assign_array(array *ary, int idx, value val) {
@@ -78,12 +334,20 @@ bool index_assign_array(array *ary, int idx, value val) {
 	}
 
 	// Assigning out of bounds just fills it with `null`.
-	while (ary->length <= (unsigned) idx)
+	while (ary->length < (unsigned) idx)
 		push_array(ary, VALUE_NULL);
 
-	free_value(ary->elements[idx]);
-	ary->elements[idx] = val;
+	if (ary->length == (unsigned) idx) {
+		push_array(ary, val);
+		return true;
+	}
+
+	prepare_to_store(ary, val);
 
+	if (ary->strategy == ARRAY_STRATEGY_VALUES)
+		free_value(ary->values[idx]);
+
+	store_element(ary, idx, val);
 	return true;
 }
 
@@ -98,14 +362,20 @@ value delete_at_array(array *ary, int idx) {
 	if (ary->length <= (unsigned) idx)
 		return VALUE_UNDEFINED;
 
-	value deleted = ary->elements[idx];
+	unshare_array(ary);
+	value deleted = element_at(ary, idx);
 
 	// shift everything left by one.
-	memmove(
-		ary->elements + idx,
-		ary->elements + idx + 1,
-		(ary->length - idx - 1) * sizeof(value)
-	);
+	if (ary->strategy == ARRAY_STRATEGY_BOOLEANS) {
+		for (unsigned i = idx; i + 1 < ary->length; i++)
+			set_bit(ary, i, get_bit(ary, i + 1));
+	} else {
+		memmove(
+			ary->values + idx,
+			ary->values + idx + 1,
+			(ary->length - idx - 1) * sizeof(value)
+		);
+	}
 	ary->length--;
 
 	return deleted;
@@ -125,13 +395,22 @@ bool insert_at_array(array *ary, int idx, value val) {
 		return true;
 	}
 
-	reallocate_if_necessary(ary);
+	prepare_to_store(ary, val);
+	reserve_array(ary, 1);
 
 	// shift everything right by one.
-	for (unsigned i = ary->length; i > (unsigned) idx; i--)
-		ary->elements[i] = ary->elements[i - 1];
+	if (ary->strategy == ARRAY_STRATEGY_BOOLEANS) {
+		for (unsigned i = ary->length; i > (unsigned) idx; i--)
+			set_bit(ary, i, get_bit(ary, i - 1));
+	} else {
+		memmove(
+			ary->values + idx + 1,
+			ary->values + idx,
+			(ary->length - idx) * sizeof(value)
+		);
+	}
 
-	ary->elements[idx] = val;
+	store_element(ary, idx, val);
 	ary->length++;
 	return true;
 }
@@ -140,19 +419,23 @@ bool insert_at_array(array *ary, int idx, value val) {
 array *concat_arrays(const array *lhs, const array *rhs) {
 	array *ret = allocate_array(lhs->length + rhs->length);
 
-	// Note that we don't use `push_array`, as that has to check capacity every time, and we know
-	// we have the right capacity, as we just allocated.
-	for (unsigned i = 0; i < lhs->length; i++) {
-		ret->elements[ret->length] = clone_value(lhs->elements[i]);
-		ret->length++;
-	}
+	append_elements(ret, lhs, 0, lhs->length);
+	append_elements(ret, rhs, 0, rhs->length);
 
-	for (unsigned i = 0; i < rhs->length; i++) {
-		ret->elements[ret->length] = clone_value(rhs->elements[i]);
-		ret->length++;
+	return ret;
+}
+
+array *append_arrays(array *lhs, const array *rhs) {
+	if (lhs->refcount != 1) {
+		array *ret = concat_arrays(lhs, rhs);
+		free_array(lhs);
+		return ret;
 	}
 
-	return ret;
+	unshare_array(lhs);
+	append_elements(lhs, rhs, 0, rhs->length);
+
+	return lhs;
 }
 
 int compare_arrays(const array *lhs, const array *rhs) {
@@ -160,7 +443,7 @@ int compare_arrays(const array *lhs, const array *rhs) {
 
 	// Check as many elements as possible and return the first discrepancy
 	for (unsigned i = 0; i < min_length; i++) {
-		int cmp = compare_values(lhs->elements[i], rhs->elements[i]);
+		int cmp = compare_values(element_at(lhs, i), element_at(rhs, i));
 
 		if (cmp != 0)
 			return cmp;
@@ -176,8 +459,12 @@ bool equate_arrays(const array *lhs, const array *rhs) {
 	if (lhs->length != rhs->length)
 		return false;
 
+	// Numbers are equal exactly when their bytes are.
+	if (lhs->strategy == ARRAY_STRATEGY_NUMBERS && rhs->strategy == ARRAY_STRATEGY_NUMBERS)
+		return !memcmp(lhs->numbers, rhs->numbers, lhs->length * sizeof(number));
+
 	for (unsigned i = 0; i < lhs->length; i++) {
-		if (!equate_values(lhs->elements[i], rhs->elements[i]))
+		if (!equate_values(element_at(lhs, i), element_at(rhs, i)))
 			return false;
 	}
 
@@ -190,51 +477,208 @@ array *replicate_array(array *ary, unsigned amnt) {
 
 	array *ret = allocate_array(ary->length * amnt);
 
-	for (unsigned i = 0; i < amnt; i++) {
-		for (unsigned j = 0; j < ary->length; j++) {
-			ret->elements[ret->length] = clone_value(ary->elements[j]);
-			ret->length++;
+	for (unsigned i = 0; i < amnt; i++)
+		append_elements(ret, ary, 0, ary->length);
+
+	return ret;
+}
+
+bool unbox_numbers(array *ary) {
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_EMPTY:
+	case ARRAY_STRATEGY_NUMBERS:
+		return true;
+
+	case ARRAY_STRATEGY_BOOLEANS:
+		return false;
+
+	default:
+		break;
+	}
+
+	for (unsigned i = 0; i < ary->length; i++) {
+		if (!is_number(ary->values[i]))
+			return false;
+	}
+
+	// Other arrays might be sharing the elements, so they can't be changed where they are.
+	unshare_array(ary);
+
+	// Numbers and values are the same size, so they can just be unboxed where they are.
+	for (unsigned i = 0; i < ary->length; i++)
+		ary->numbers[i] = as_number(ary->values[i]);
+
+	ary->strategy = ARRAY_STRATEGY_NUMBERS;
+	return true;
+}
+
+int index_of_array(const array *ary, value val) {
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_NUMBERS: {
+		if (!is_number(val))
+			return -1;
+
+		unsigned idx = index_of_number(ary->numbers, ary->length, as_number(val));
+		return idx == ary->length ? -1 : (int) idx;
+	}
+
+	case ARRAY_STRATEGY_BOOLEANS:
+		if (!is_boolean(val))
+			return -1;
+		break;
+
+	case ARRAY_STRATEGY_VALUES:
+		break;
+
+	default:
+		return -1;
+	}
+
+	for (unsigned i = 0; i < ary->length; i++) {
+		if (equate_values(element_at(ary, i), val))
+			return i;
+	}
+
+	return -1;
+}
+
+unsigned count_array(const array *ary, value val) {
+	switch (ary->strategy) {
+	case ARRAY_STRATEGY_NUMBERS:
+		return is_number(val) ? count_number(ary->numbers, ary->length, as_number(val)) : 0;
+
+	case ARRAY_STRATEGY_BOOLEANS: {
+		if (!is_boolean(val))
+			return 0;
+
+		// Count the `true`s a word at a time, ignoring the unused bits of the last word.
+		unsigned trues = 0;
+		for (unsigned i = 0; i < ary->length / BITS_PER_WORD; i++)
+			trues += __builtin_popcountll(ary->bits[i]);
+
+		if (ary->length % BITS_PER_WORD != 0) {
+			unsigned long long last = ary->bits[ary->length / BITS_PER_WORD];
+			trues += __builtin_popcountll(last & ((1ULL << (ary->length % BITS_PER_WORD)) - 1));
 		}
+
+		return val == VALUE_TRUE ? trues : ary->length - trues;
 	}
 
-	return ret;
+	case ARRAY_STRATEGY_VALUES: {
+		unsigned count = 0;
+
+		for (unsigned i = 0; i < ary->length; i++)
+			count += equate_values(ary->values[i], val);
+
+		return count;
+	}
+
+	default:
+		return 0;
+	}
 }
 
-string *array_to_string(const array *ary) {
+void fill_array(array *ary, value val) {
 	if (ary->length == 0)
-		return new_string(strdup("[]"), 2);
+		return;
 
-	unsigned length = 1; // as we start with `[`.
-	unsigned capacity = 8;
-	char *str = xmalloc(capacity);
-	str[0] = '[';
+	unshare_array(ary);
+	array_strategy strategy = strategy_for(val);
 
-	for (unsigned i = 0; i < ary->length; i++) {
-		string *inspected_string = inspect_value(ary->elements[i]);
+	if (ary->strategy == ARRAY_STRATEGY_VALUES) {
+		for (unsigned i = 0; i < ary->length; i++)
+			free_value(ary->values[i]);
+	}
+
+	// Every element is being replaced, so the old ones can just be thrown out.
+	if (ary->strategy != strategy) {
+		unsigned length = ary->length;
+		pool_free(ary->elements, storage_size(ary->strategy, ary->capacity));
+
+		ary->strategy = ARRAY_STRATEGY_EMPTY;
+		ary->elements = NULL;
+		ary->capacity = length;
+		adopt_strategy(ary, strategy);
+	}
+
+	switch (strategy) {
+	case ARRAY_STRATEGY_NUMBERS:
+		fill_numbers(ary->numbers, ary->length, as_number(val));
+		break;
+
+	case ARRAY_STRATEGY_BOOLEANS:
+		memset(ary->bits, val == VALUE_TRUE ? 0xff : 0, storage_size(strategy, ary->capacity));
+		break;
+
+	default:
+		for (unsigned i = 0; i < ary->length; i++)
+			ary->values[i] = clone_value(val);
+	}
+}
+
+array *copy_array(const array *ary) {
+	array *ret = allocate_array(ary->length);
+	append_elements(ret, ary, 0, ary->length);
+	return ret;
+}
 
-		// the `+ 2` is for the `, ` we add.
-		if (capacity <= length + inspected_string->length + 2) {
-			capacity = (length + inspected_string->length + 2) * 2;
-			str = xrealloc(str, capacity);
+static int compare_values_for_sort(value lhs, value rhs, void *context) {
+	(void) context;
+	return compare_values(lhs, rhs);
+}
+
+// When all the elements are known to be strings, there's no need to check their kinds each time.
+static int compare_strings_for_sort(value lhs, value rhs, void *context) {
+	(void) context;
+	string_view lhs_view, rhs_view;
+
+	view_string_value(lhs, &lhs_view);
+	view_string_value(rhs, &rhs_view);
+	return compare_bytes(lhs_view.ptr, lhs_view.length, rhs_view.ptr, rhs_view.length);
+}
+
+void sort_array(array *ary, sort_comparator compare, void *context) {
+	if (ary->length < 2)
+		return;
+
+	unshare_array(ary);
+
+	if (compare == NULL && unbox_numbers(ary)) {
+		sort_numbers(ary->numbers, ary->length);
+		return;
+	}
+
+	generalize_array(ary);
+
+	if (compare == NULL) {
+		compare = compare_strings_for_sort;
+
+		for (unsigned i = 0; i < ary->length; i++) {
+			if (!is_string(ary->values[i])) {
+				compare = compare_values_for_sort;
+				break;
+			}
 		}
+	}
 
+	sort_values(ary->values, ary->length, compare, context);
+}
+
+string *array_to_string(const array *ary) {
+	string *str = allocate_string(8);
+	str = push_string(str, "[", 1);
+
+	for (unsigned i = 0; i < ary->length; i++) {
 		// If it's not the first element in the array, add `, ` before it.
-		if (i != 0) {
-			str[length] = ',';
-			str[length + 1] = ' ';
-			length += 2;
-		}
+		if (i != 0)
+			str = push_string(str, ", ", 2);
 
-		memcpy(str + length, inspected_string->ptr, inspected_string->length);
-		length += inspected_string->length;
+		string *inspected_string = inspect_value(element_at(ary, i));
+		str = push_string(str, string_ptr(inspected_string), inspected_string->length);
 		free_string(inspected_string);
 	}
 
-	// Allocate space for the trailing `]`
-	str = xrealloc(str, length + 1);
-	str[length] = ']';
-
-	return new_string(str, length + 1);
+	return push_string(str, "]", 1);
 }
 
 void dump_array(FILE *out, const array *ary) {
@@ -244,7 +688,7 @@ void dump_array(FILE *out, const array *ary) {
 		if (i != 0)
 			fputs(", ", out);
 
-		dump_value(out, ary->elements[i]);
+		dump_value(out, element_at(ary, i));
 	}
 
 	fputc(')', out);
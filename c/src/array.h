@@ -5,25 +5,64 @@
 #include "shared.h"
 #include "valuedefn.h"
 #include "string_.h"
+#include "pool.h"
+#include "number.h"
+#include "sort.h"
 #include <stdio.h>
 
+#ifndef ARRAY_SLICE_MIN_LENGTH
+# define ARRAY_SLICE_MIN_LENGTH 16
+#endif
+
+/** How an array's elements are stored.
+ * 
+ * Arrays start out empty, and pick a strategy when their first element is added: numbers are stored
+ * unboxed, booleans as a bitset, and everything else as `value`s. Adding an element that doesn't fit
+ * the array's strategy converts it to `ARRAY_STRATEGY_VALUES`, which it then stays as (unless it's
+ * passed to `unbox_numbers` or `fill_array`).
+ */
+typedef enum {
+	ARRAY_STRATEGY_EMPTY,
+	ARRAY_STRATEGY_NUMBERS,
+	ARRAY_STRATEGY_BOOLEANS,
+	ARRAY_STRATEGY_VALUES,
+} array_strategy;
+
 /** The array type within Friar.
+ * 
+ * Arrays can share their elements with slices of them (see `slice_array`). When they do, the
+ * elements are owned by a hidden "storage" array (`parent`), which is never modified, and `elements`
+ * points into it. Arrays with a `parent` copy their elements out of it before they're modified, so
+ * neither the slices nor the original array see each other's changes.
+ * 
+ * Empty-strategy arrays have no `elements`; their `capacity` is how many to make room for once the
+ * first is added.
  */
-typedef struct {
-	VALUE_ALIGNMENT value *elements;
+typedef struct array array;
+struct array {
+	union {
+		VALUE_ALIGNMENT void *elements;
+		value *values;
+		number *numbers;
+		unsigned long long *bits;
+	};
 	unsigned refcount, length, capacity;
-} array;
+	array_strategy strategy;
+	array *parent;
+};
 
 /** Creates a new array with the given elements, length, and capacity.
  * 
- * This takes ownership of `elements`. Note that `capacity` must be at least `length`.
+ * This takes ownership of `elements`, which must have been allocated with `pool_alloc` and be stored
+ * according to `strategy`. Note that `capacity` must be at least `length`.
  */
-array *new_array(value *elements, unsigned length, unsigned capacity);
+array *new_array(array_strategy strategy, void *elements, unsigned length, unsigned capacity);
 
-/** Allocates an array which can old at least `capacity` elements.
+/** Allocates an empty array which will have room for at least `capacity` elements once the first
+ * one is added.
  */
 static inline array *allocate_array(unsigned capacity) {
-	return new_array(xmalloc(sizeof(value) * capacity), 0, capacity);
+	return new_array(ARRAY_STRATEGY_EMPTY, NULL, 0, capacity);
 }
 
 
@@ -56,6 +95,15 @@ static inline array *clone_array(array *ary) {
 	return ary;
 }
 
+/** Returns an array of the `length` elements of `ary` starting at `start`, which must be in bounds.
+ * 
+ * Rather than copying the elements, the slice shares them with `ary` (which is why `ary` isn't
+ * const: its elements are moved into a storage array the first time it's sliced). Slices shorter than
+ * `ARRAY_SLICE_MIN_LENGTH` are copied instead, as they're cheap to copy, and so that lots of short
+ * slices don't keep a large array's elements around.
+ */
+array *slice_array(array *ary, unsigned start, unsigned length);
+
 /** Pushes `val` onto the end of `ary`.
  * 
  * Ownership of `val` is passed to `ary`.
@@ -116,6 +164,13 @@ bool insert_at_array(array *ary, int index, value val);
  */
 array *concat_arrays(const array *lhs, const array *rhs);
 
+/** Appends a clone of each of `rhs`'s elements to `lhs`, returning the combined array.
+ * 
+ * Ownership of `lhs` is given to this function. If `lhs` has no other references, it's appended to
+ * in place (growing geometrically) and returned; otherwise, this is just `concat_arrays`.
+ */
+array *append_arrays(array *lhs, const array *rhs);
+
 /** Compares `lhs` to `rhs`, returning a negative, zero, or positive number if `lhs` is less than,
  * equal to, or greater than `rhs`.
  * 
@@ -127,5 +182,40 @@ int compare_arrays(const array *lhs, const array *rhs);
 bool equate_arrays(const array *lhs, const array *rhs);
 array *replicate_array(array *ary, unsigned amnt);
 
+/** Converts `ary` to `ARRAY_STRATEGY_NUMBERS` if all its elements are numbers, returning whether
+ * it was able to.
+ * 
+ * This is for the numeric builtins, which work on `ary->numbers` directly. Empty arrays are left
+ * as-is (and so `ary->numbers` may be `NULL`), but `true` is still returned.
+ */
+bool unbox_numbers(array *ary);
+
+/** Returns the index of the first element of `ary` that's equal to `val`, or -1 if there's none.
+ */
+int index_of_array(const array *ary, value val);
+
+/** Returns how many elements of `ary` are equal to `val`.
+ */
+unsigned count_array(const array *ary, value val);
+
+/** Sets every element of `ary` to `val`.
+ * 
+ * As every element is replaced, `ary` is given whichever strategy best suits `val`. Ownership of
+ * `val` isn't given to `ary`.
+ */
+void fill_array(array *ary, value val);
+
+/** Returns a new array with the same elements as `ary`, which doesn't share them with it.
+ */
+array *copy_array(const array *ary);
+
+/** Sorts `ary` in place.
+ * 
+ * If `compare` is `NULL`, elements are sorted by `compare_values`, except that arrays of numbers are
+ * radix sorted and arrays of strings are compared directly. Otherwise, they're sorted by `compare`,
+ * which is passed `context`.
+ */
+void sort_array(array *ary, sort_comparator compare, void *context);
+
 string *array_to_string(const array *ary);
 void dump_array(FILE *out, const array *ary);
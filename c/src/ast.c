@@ -1,10 +1,18 @@
 #include "ast.h"
 #include "token.h"
 #include "value.h"
+#include "compile.h"
 #include <stdlib.h>
 #include <assert.h>
 
+// All the nodes of a declaration live in the tokenizer's arena, so they can be released all at once
+// after it's been compiled.
+#define new_node(tzr, type) ((type *) arena_alloc((tzr)->arena, sizeof(type)))
+#define grow_nodes(tzr, nodes, old_capacity, new_capacity) \
+	arena_realloc((tzr)->arena, (nodes), (old_capacity) * sizeof(*(nodes)), (new_capacity) * sizeof(*(nodes)))
+
 #define parse_error(tzr, ...) ( \
+	compile_parsed_functions(), \
 	fprintf(stderr, "parse error at line %d: ", tzr->line_number), \
 	fprintf(stderr, __VA_ARGS__), \
 	exit(1))
@@ -36,7 +44,7 @@ static bool guard(tokenizer *tzr, token_kind kind) {
 	return false;
 }
 
-static char *expect_identifier(tokenizer *tzr, const char *whence) {
+static const char *expect_identifier(tokenizer *tzr, const char *whence) {
 	token tkn = advance(tzr);
 
 	if (tkn.kind != TOKEN_KIND_IDENTIFIER)
@@ -47,7 +55,7 @@ static char *expect_identifier(tokenizer *tzr, const char *whence) {
 
 static ast_expression *parse_expression(tokenizer *tzr);
 static ast_primary *parse_primary(tokenizer *tzr) {
-	ast_primary *primary = xmalloc(sizeof(ast_primary));
+	ast_primary *primary = new_node(tzr, ast_primary);
 	token tkn = advance(tzr);
 
 	// Parse the initial primary
@@ -69,13 +77,13 @@ static ast_primary *parse_primary(tokenizer *tzr) {
 
 		unsigned capacity = 4;
 		primary->array_literal.length = 0;
-		primary->array_literal.elements = xmalloc(capacity * sizeof(ast_expression *));
+		primary->array_literal.elements = grow_nodes(tzr, primary->array_literal.elements, 0, capacity);
 
 		while (!guard(tzr, TOKEN_KIND_RBRACKET)) {
 			if (primary->array_literal.length == capacity) {
-				capacity *= 2;
 				primary->array_literal.elements =
-					xrealloc(primary->array_literal.elements, capacity * sizeof(ast_expression *));
+					grow_nodes(tzr, primary->array_literal.elements, capacity, capacity * 2);
+				capacity *= 2;
 			}
 
 			primary->array_literal.elements[primary->array_literal.length] = parse_expression(tzr);
@@ -114,7 +122,6 @@ static ast_primary *parse_primary(tokenizer *tzr) {
 
 	default:
 		unadvance(tzr, tkn);
-		free(primary);
 		return NULL;
 	}
 
@@ -126,7 +133,7 @@ static ast_primary *parse_primary(tokenizer *tzr) {
 
 		switch (tkn.kind) {
 		case TOKEN_KIND_LBRACKET:
-			temp_primary = xmalloc(sizeof(ast_primary));
+			temp_primary = new_node(tzr, ast_primary);
 			temp_primary->kind = AST_PRIMARY_INDEX;
 			temp_primary->index.source = primary;
 			primary = temp_primary;
@@ -142,20 +149,20 @@ static ast_primary *parse_primary(tokenizer *tzr) {
 			break;
 
 		case TOKEN_KIND_LPAREN:
-			temp_primary = xmalloc(sizeof(ast_primary));
+			temp_primary = new_node(tzr, ast_primary);
 			temp_primary->kind = AST_PRIMARY_FUNCTION_CALL;
 			temp_primary->function_call.function = primary;
 			primary = temp_primary;
 
 			unsigned capacity = 4;
 			primary->function_call.number_of_arguments = 0;
-			primary->function_call.arguments = xmalloc(capacity * sizeof(ast_expression *));
+			primary->function_call.arguments = grow_nodes(tzr, (ast_expression **) NULL, 0, capacity);
 
 			while (!guard(tzr, TOKEN_KIND_RPAREN)) {
 				if (primary->function_call.number_of_arguments == capacity) {
-					capacity *= 2;
 					primary->function_call.arguments =
-						xrealloc(primary->function_call.arguments, capacity * sizeof(ast_expression *));
+						grow_nodes(tzr, primary->function_call.arguments, capacity, capacity * 2);
+					capacity *= 2;
 				}
 
 				primary->function_call.arguments[primary->function_call.number_of_arguments] =
@@ -207,7 +214,7 @@ static ast_expression *parse_expression(tokenizer *tzr) {
 	if (primary == NULL)
 		return NULL;
 
-	ast_expression *expression = xmalloc(sizeof(ast_expression));
+	ast_expression *expression = new_node(tzr, ast_expression);
 	token tkn = advance(tzr);
 
 	switch (tkn.kind) {
@@ -241,7 +248,6 @@ static ast_expression *parse_expression(tokenizer *tzr) {
 			parse_error(tzr, "you may online assign to identifiers and array indexes");
 		}
 
-		free(primary);
 		break;
 	}
 
@@ -293,7 +299,7 @@ static ast_expression *parse_expression(tokenizer *tzr) {
 static ast_block *parse_block(tokenizer *tzr);
 
 static ast_statement *parse_statement(tokenizer *tzr) {
-	ast_statement *statement = xmalloc(sizeof(ast_statement));
+	ast_statement *statement = new_node(tzr, ast_statement);
 	token tkn = advance(tzr);
 
 	switch (tkn.kind) {
@@ -390,10 +396,8 @@ static ast_statement *parse_statement(tokenizer *tzr) {
 		unadvance(tzr, tkn);
 		statement->kind = AST_STATEMENT_EXPRESSION;
 		statement->expression = parse_expression(tzr);
-		if (statement->expression == NULL) {
-			free(statement);
+		if (statement->expression == NULL)
 			return NULL;
-		}
 
 		if (!guard(tzr, TOKEN_KIND_SEMICOLON))
 			parse_error(tzr, "expected `;` after expression");
@@ -407,11 +411,11 @@ static ast_block *parse_block(tokenizer *tzr) {
 	if (!guard(tzr, TOKEN_KIND_LBRACE))
 		return NULL;
 
-	ast_block *block = xmalloc(sizeof(ast_block));
+	ast_block *block = new_node(tzr, ast_block);
 
 	unsigned capacity = 4;
 	block->number_of_statements = 0;
-	block->statements = xmalloc(capacity * sizeof(ast_statement *));
+	block->statements = grow_nodes(tzr, (ast_statement **) NULL, 0, capacity);
 
 	while (!guard(tzr, TOKEN_KIND_RBRACE)) {
 		while (guard(tzr, TOKEN_KIND_SEMICOLON)) {
@@ -420,14 +424,14 @@ static ast_block *parse_block(tokenizer *tzr) {
 
 		ast_statement *statement = parse_statement(tzr);
 		if (statement == NULL) {
-			if (!guard(tzr, TOKEN_KIND_RBRACKET))
+			if (!guard(tzr, TOKEN_KIND_RBRACE))
 				parse_error(tzr, "expected `}` at end of block body");
 			break;
 		}
 
 		if (capacity == block->number_of_statements) {
+			block->statements = grow_nodes(tzr, block->statements, capacity, capacity * 2);
 			capacity *= 2;
-			block->statements = xrealloc(block->statements, capacity * sizeof(ast_statement *));
 		}
 
 		block->statements[block->number_of_statements] = statement;
@@ -437,8 +441,114 @@ static ast_block *parse_block(tokenizer *tzr) {
 	return block;
 }
 
-ast_declaration *next_declaration(tokenizer *tzr) {
-	ast_declaration *declaration = xmalloc(sizeof(ast_declaration));
+// The streaming versions of `parse_statement` and `parse_block`, which generate the code for each
+// statement into `builder` as soon as it's parsed, and then discard its nodes. Only the statements
+// which contain blocks need special handling; everything else is parsed normally and then compiled.
+static bool stream_block(tokenizer *tzr, codeblock_builder *builder);
+
+static bool stream_statement(tokenizer *tzr, codeblock_builder *builder) {
+	token tkn = advance(tzr);
+
+	switch (tkn.kind) {
+	case TOKEN_KIND_WHILE: {
+		ast_expression *condition = parse_expression(tzr);
+		if (condition == NULL)
+			parse_error(tzr, "expected condition for `while`");
+
+		unsigned jump_to_end = compile_while_condition(builder, condition);
+
+		if (!stream_block(tzr, builder))
+			parse_error(tzr, "expected body for `while`");
+
+		compile_end_loop(builder, jump_to_end);
+		return true;
+	}
+
+	case TOKEN_KIND_FOR: {
+		ast_statement *initializer = parse_statement(tzr);
+		if (initializer == NULL)
+			parse_error(tzr, "expected initializer for `for`");
+
+		ast_expression *condition = parse_expression(tzr);
+		if (condition == NULL)
+			parse_error(tzr, "expected condition for `for`");
+
+		if (!guard(tzr, TOKEN_KIND_SEMICOLON))
+			parse_error(tzr, "expected `;` after `condition`");
+
+		ast_expression *updator = parse_expression(tzr);
+		if (updator == NULL)
+			parse_error(tzr, "expected updator clause for `for`");
+
+		unsigned jump_to_end = compile_for_header(builder, initializer, condition, updator);
+
+		if (!stream_block(tzr, builder))
+			parse_error(tzr, "expected body for `for`");
+
+		compile_end_loop(builder, jump_to_end);
+		return true;
+	}
+
+	case TOKEN_KIND_IF: {
+		ast_expression *condition = parse_expression(tzr);
+		if (condition == NULL)
+			parse_error(tzr, "expected condition for `if`");
+
+		unsigned pending_jump = compile_if_condition(builder, condition);
+
+		if (!stream_block(tzr, builder))
+			parse_error(tzr, "expected body for `if`");
+
+		if (guard(tzr, TOKEN_KIND_ELSE)) {
+			pending_jump = compile_else(builder, pending_jump);
+
+			if (!stream_block(tzr, builder))
+				parse_error(tzr, "expected body for `else`");
+		}
+
+		compile_end_if(builder, pending_jump);
+		return true;
+	}
+
+	default: {
+		unadvance(tzr, tkn);
+
+		ast_statement *statement = parse_statement(tzr);
+		if (statement == NULL)
+			return false;
+
+		compile_statement(builder, statement);
+		return true;
+	}
+	}
+}
+
+static bool stream_block(tokenizer *tzr, codeblock_builder *builder) {
+	if (!guard(tzr, TOKEN_KIND_LBRACE))
+		return false;
+
+	while (!guard(tzr, TOKEN_KIND_RBRACE)) {
+		while (guard(tzr, TOKEN_KIND_SEMICOLON)) {
+			// eat random leading semicolons.
+		}
+
+		arena_position before_statement = save_arena(tzr->arena);
+		bool streamed = stream_statement(tzr, builder);
+		restore_arena(tzr->arena, before_statement);
+
+		if (!streamed) {
+			if (!guard(tzr, TOKEN_KIND_RBRACE))
+				parse_error(tzr, "expected `}` at end of block body");
+			break;
+		}
+	}
+
+	return true;
+}
+
+ast_declaration *next_declaration(tokenizer *tzr, arena *arena, bool streaming) {
+	tzr->arena = arena;
+	ast_declaration *declaration = new_node(tzr, ast_declaration);
 	token tkn = advance(tzr);
 
 	declaration->source.line_number = tzr->line_number;
@@ -465,9 +575,10 @@ ast_declaration *next_declaration(tokenizer *tzr) {
 
 		// `read_file` expects a nul terminated string, but `string`s are not nul terminated.
 		// So we have to make one.
-		string *path_string = as_string(path_token.val);
+		string *path_string = value_to_string(path_token.val);
 		declaration->import.path = new_cstr_from_string(path_string);
 		free_string(path_string);
+		free_value(path_token.val);
 
 		if (declaration->import.path == NULL)
 			parse_error(tzr, "import paths must not contain `\\0`");
@@ -483,13 +594,15 @@ ast_declaration *next_declaration(tokenizer *tzr) {
 
 		unsigned capacity = 4;
 		declaration->function.number_of_arguments = 0;
-		declaration->function.argument_names = xmalloc(capacity * sizeof(char *));
+		// The argument names are handed off to the function, so unlike the rest of the AST, they aren't
+		// allocated in the arena.
+		declaration->function.argument_names = xmalloc(capacity * sizeof(const char *));
 
 		while (!guard(tzr, TOKEN_KIND_RPAREN)) {
 			if (declaration->function.number_of_arguments == capacity) {
 				capacity *= 2;
 				declaration->function.argument_names =
-					xrealloc(declaration->function.argument_names, capacity * sizeof(char *));
+					xrealloc(declaration->function.argument_names, capacity * sizeof(const char *));
 			}
 
 			declaration->function.argument_names[declaration->function.number_of_arguments] =
@@ -503,6 +616,17 @@ ast_declaration *next_declaration(tokenizer *tzr) {
 			}
 		}
 
+		if (streaming) {
+			codeblock_builder *builder = begin_function(declaration);
+
+			if (!stream_block(tzr, builder))
+				parse_error(tzr, "expected body for function %s", declaration->function.name);
+
+			finish_function(builder, declaration);
+			declaration->function.body = NULL;
+			break;
+		}
+
 		declaration->function.body = parse_block(tzr);
 		if (declaration->function.body == NULL)
 			parse_error(tzr, "expected body for function %s", declaration->function.name);
@@ -510,7 +634,6 @@ ast_declaration *next_declaration(tokenizer *tzr) {
 		break;
 
 	case TOKEN_KIND_UNDEFINED:
-		free(declaration);
 		return NULL;
 
 	default:
@@ -730,6 +853,11 @@ void dump_ast_declaration(FILE *out, const ast_declaration *declaration) {
 		}
 
 		fputs(") ", out);
-		dump_ast_block(out, declaration->function.body, 1);
+
+		// Streamed functions don't keep their bodies around.
+		if (declaration->function.body == NULL)
+			fputs("{ ... }\n", out);
+		else
+			dump_ast_block(out, declaration->function.body, 1);
 	}
 }
@@ -2,6 +2,8 @@
 
 #include "valuedefn.h"
 #include "token.h"
+#include "arena.h"
+#include <stdbool.h>
 
 typedef struct ast_expression ast_expression;
 typedef struct ast_primary ast_primary;
@@ -53,7 +55,7 @@ struct ast_primary {
 		} array_literal;
 
 		struct {
-			char *name;
+			const char *name;
 		} variable;
 
 		struct {
@@ -94,7 +96,7 @@ struct ast_expression {
 	union {
 		struct {
 			binary_operator operator; // Set to `BINARY_OP_UNDEF` when normal assignment.
-			char *name;
+			const char *name;
 			ast_expression *value;
 		} assign;
 
@@ -134,7 +136,7 @@ struct ast_statement {
 
 	union {
 		struct {
-			char *name;
+			const char *name;
 			ast_expression *initializer; // is `NULL` if no default is given.
 		} local;
 
@@ -186,27 +188,27 @@ struct ast_declaration {
 		} import;
 
 		struct {
-			char *name;
+			const char *name;
 		} global;
 
 		struct {
-			char *name;
+			const char *name;
 
 			unsigned number_of_arguments;
-			char **argument_names;
+			const char **argument_names;
 
 			ast_block *body;
 		} function;
 	};
 };
 
-ast_declaration *next_declaration(tokenizer *tzr);
-
-void free_ast_primary(ast_primary *primary);
-void free_ast_expression(ast_expression *expression);
-void free_ast_statement(ast_statement *statement);
-void free_ast_block(ast_block *block);
-void free_ast_declaration(ast_declaration *declaration);
+// Parses the next declaration, returning `NULL` at the end of the stream. Everything in the tree is
+// allocated in `arena` (except the argument names of functions, and import paths), so it's all freed
+// at once when `arena` is reset.
+//
+// If `streaming` is set, functions are compiled while they're parsed (see `compile_options`), and the
+// returned declaration's `body` is `NULL`.
+ast_declaration *next_declaration(tokenizer *tzr, arena *arena, bool streaming);
 
 void dump_ast_primary(FILE *out, const ast_primary *primary);
 void dump_ast_expression(FILE *out, const ast_expression *expression);
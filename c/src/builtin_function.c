@@ -1,8 +1,25 @@
 #include "builtin_function.h"
 #include "value.h"
+#include "kernels.h"
 #include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef OUTPUT_BUFFER_SIZE
+# define OUTPUT_BUFFER_SIZE (64 * 1024)
+#endif
 
 void init_builtin_functions(void) {
+	// Output is only written when the buffer fills up, and by `flush`, `prompt`, errors, and exiting.
+	// On a terminal, it's also written after each line, so interactive programs still work as expected.
+	static char output_buffer[OUTPUT_BUFFER_SIZE];
+	setvbuf(stdout, output_buffer, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, sizeof(output_buffer));
+
 	// the `srandom` function provides much better random numbers, but isn't technically standard.
 #ifdef SRANDOM_UNDEFINED
 	srand(time(NULL));
@@ -32,61 +49,284 @@ static value builtin_to_num_fn(const value *arguments) {
 	if (!is_string(arguments[0]))
 		die_with_stacktrace("Can only convert strings to numbers, not %s", value_name(arguments[0]));
 
-	return new_number_value(string_to_number(as_string(arguments[0])));
+	string *str = value_to_string(arguments[0]);
+	number num = string_to_number(str);
+	free_string(str);
+
+	return new_number_value(num);
 }
 
-static value builtin_prompt_fn(const value *arguments) {
-	(void) arguments;
+// stdin is read in large chunks into this string, which `prompt`, `read_lines`, and `read_all` all
+// share, so they can be used together. Long lines are slices of it (see `slice_string`), so a chunk
+// is only reused if none of its lines are still around.
+#ifndef INPUT_BUFFER_SIZE
+# define INPUT_BUFFER_SIZE (64 * 1024)
+#endif
 
-	size_t capacity = 0;
-	ssize_t length;
-	char *line = NULL;
+static struct {
+	unsigned start, end; // The part of `chunk` that hasn't been used yet.
+	string *chunk; // `NULL` until stdin's first read.
+} input;
 
-	// TODO: use fgets instead
-	if ((length = getline(&line, &capacity, stdin)) == -1) {
-		assert(line != NULL);
-		free(line);
+// Reads the next chunk of stdin, once everything in the current one's been used. Returns false at the
+// end of the input.
+static bool refill_input(void) {
+	assert(input.start == input.end);
 
-		if (!feof(stdin))
-			die_with_stacktrace("unable to read line from stdin");
+	if (input.chunk == NULL || input.chunk->refcount != 1) {
+		if (input.chunk != NULL)
+			free_string(input.chunk);
 
-		return new_string_value(new_string(strdup(""), 0));
+		input.chunk = allocate_string(INPUT_BUFFER_SIZE);
 	}
 
-	assert(0 < length);
-	assert(line != NULL);
+	ssize_t amount;
+	do {
+		amount = read(STDIN_FILENO, input.chunk->bytes, INPUT_BUFFER_SIZE);
+	} while (amount < 0 && errno == EINTR);
 
-	// strip trialing newlines
-	if (length != 0 && line[length - 1] == '\n') {
+	if (amount < 0)
+		die_with_stacktrace("unable to read from stdin: %s", strerror(errno));
+
+	input.chunk->length = amount;
+	input.start = 0;
+	input.end = amount;
+	return amount != 0;
+}
+
+static unsigned strip_carriage_return(const char *ptr, unsigned length) {
+	if (length != 0 && ptr[length - 1] == '\r')
 		length--;
-		if (length != 0 && line[length - 1] == '\r')
-			length--;
+
+	return length;
+}
+
+// Reads the next line from stdin, without its line ending. Returns `VALUE_UNDEFINED` if there's no
+// more input.
+static value read_line(void) {
+	if (input.start == input.end && !refill_input())
+		return VALUE_UNDEFINED;
+
+	// Usually, the whole line's already in the chunk.
+	const char *line = &input.chunk->bytes[input.start];
+	const char *newline = memchr(line, '\n', input.end - input.start);
+
+	if (newline != NULL) {
+		unsigned start = input.start, length = strip_carriage_return(line, newline - line);
+		input.start += newline - line + 1;
+
+		if (length < STRING_SLICE_MIN_LENGTH)
+			return new_string_value_from_bytes(line, length);
+
+		return new_string_value(slice_string(input.chunk, start, length));
 	}
 
-	value ret = new_string_value(new_string(strndup(line, length), length));
-	free(line);
+	// Otherwise, it continues on into the next chunk (or more), so collect it separately.
+	size_t length = 0, capacity = 2 * (input.end - input.start) + 64;
+	char *collected = xmalloc(capacity);
 
+	do {
+		line = &input.chunk->bytes[input.start];
+		newline = memchr(line, '\n', input.end - input.start);
+		unsigned amount = (newline == NULL ? &input.chunk->bytes[input.end] : newline) - line;
+
+		if (capacity < length + amount) {
+			capacity = 2 * (length + amount);
+			collected = xrealloc(collected, capacity);
+		}
+
+		memcpy(&collected[length], line, amount);
+		length += amount;
+		input.start += amount + (newline != NULL);
+	} while (newline == NULL && refill_input());
+
+	if (UINT_MAX < length)
+		die_with_stacktrace("line from stdin is too long (%zu bytes)", length);
+
+	value ret = new_string_value_from_bytes(collected, strip_carriage_return(collected, length));
+	free(collected);
 	return ret;
 }
 
-static value builtin_print_fn(const value *arguments) {
-	string *to_print = value_to_string(arguments[0]);
+static value builtin_prompt_fn(const value *arguments) {
+	(void) arguments;
 
-	printf("%.*s", to_print->length, to_print->ptr);
+	// Make sure whatever we're prompting with has been written.
 	fflush(stdout);
 
-	free_string(to_print);
+	value line = read_line();
+	return line == VALUE_UNDEFINED ? new_string_value(allocate_string(0)) : line;
+}
+
+static value builtin_read_lines_fn(const value *arguments) {
+	(void) arguments;
+
+	fflush(stdout);
+
+	array *lines = allocate_array(16);
+	value line;
+
+	while ((line = read_line()) != VALUE_UNDEFINED)
+		push_array(lines, line);
+
+	return new_array_value(lines);
+}
+
+static value builtin_read_all_fn(const value *arguments) {
+	(void) arguments;
+
+	fflush(stdout);
+
+	string *contents = allocate_string(input.end - input.start);
+
+	do {
+		if (input.start == input.end)
+			continue;
+
+		if (UINT_MAX - contents->length < input.end - input.start)
+			die_with_stacktrace("input from stdin is too long");
+
+		contents = push_string(contents, &input.chunk->bytes[input.start], input.end - input.start);
+		input.start = input.end;
+	} while (refill_input());
+
+	return new_string_value(contents);
+}
+
+// Files at least this large are mapped into memory by `read_file`, rather than being read into a
+// buffer; for smaller files, setting up (and tearing down) the mapping costs more than copying.
+#ifndef MAPPED_FILE_THRESHOLD
+# define MAPPED_FILE_THRESHOLD (64 * 1024)
+#endif
+
+// Returns the contents of the file `path_value` names. If `must_map` is set, they're always mapped
+// into memory (unless they'd fit in a small string), and it's an error if that's not possible.
+static value read_file_value(value path_value, const char *builtin_name, bool must_map) {
+	if (!is_string(path_value))
+		die_with_stacktrace("can only `%s` strings, not %s", builtin_name, value_name(path_value));
+
+	string *path_string = value_to_string(path_value);
+	char *path = new_cstr_from_string(path_string);
+	free_string(path_string);
+
+	if (path == NULL)
+		die_with_stacktrace("file paths must not contain `\\0`");
+
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+
+	if (fd < 0 || fstat(fd, &info))
+		die_with_stacktrace("unable to read file '%s': %s", path, strerror(errno));
+
+	bool is_regular = S_ISREG(info.st_mode);
+
+	if (is_regular && UINT_MAX < (uintmax_t) info.st_size)
+		die_with_stacktrace("unable to read file '%s': it's too large", path);
+
+	if (must_map && !is_regular)
+		die_with_stacktrace("unable to map file '%s': it's not a regular file", path);
+
+	string *contents;
+
+	if (is_regular && SMALL_STRING_MAX_LENGTH < info.st_size
+		&& (must_map || MAPPED_FILE_THRESHOLD <= info.st_size)
+	) {
+		void *ptr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (ptr == MAP_FAILED)
+			die_with_stacktrace("unable to map file '%s': %s", path, strerror(errno));
+
+		contents = new_mapped_string(ptr, info.st_size);
+		goto done;
+	}
+
+	contents = allocate_string(is_regular ? info.st_size : 4096);
+
+	while (true) {
+		char buffer[4096];
+		ssize_t amount = read(fd, buffer, sizeof(buffer));
+
+		if (amount < 0 && errno == EINTR)
+			continue;
+
+		if (amount < 0)
+			die_with_stacktrace("unable to read file '%s': %s", path, strerror(errno));
+
+		if (amount == 0)
+			break;
+
+		if (UINT_MAX - contents->length < (size_t) amount)
+			die_with_stacktrace("unable to read file '%s': it's too large", path);
+
+		contents = push_string(contents, buffer, amount);
+	}
+
+done:
+	close(fd);
+	free(path);
+	return new_string_value(contents);
+}
+
+static value builtin_read_file_fn(const value *arguments) {
+	return read_file_value(arguments[0], "read_file", false);
+}
+
+static value builtin_open_mapped_fn(const value *arguments) {
+	return read_file_value(arguments[0], "open_mapped", true);
+}
+
+// Writes `val` straight into stdout's buffer, without converting it to a `string` first.
+static void print_value(value val) {
+	switch (classify(val)) {
+	case VALUE_KIND_STRING: {
+		string_view view;
+		view_string_value(val, &view);
+		fwrite(view.ptr, 1, view.length, stdout);
+		break;
+	}
+
+	case VALUE_KIND_NUMBER:
+		printf("%lld", as_number(val));
+		break;
+
+	case VALUE_KIND_BOOLEAN:
+		fputs(val == VALUE_TRUE ? "true" : "false", stdout);
+		break;
+
+	case VALUE_KIND_NULL:
+		fputs("null", stdout);
+		break;
+
+	default: {
+		string *to_print = value_to_string(val);
+		fwrite(string_ptr(to_print), 1, to_print->length, stdout);
+		free_string(to_print);
+		break;
+	}
+	}
+}
+
+static value builtin_print_fn(const value *arguments) {
+	print_value(arguments[0]);
 	return VALUE_NULL;
 }
 
 static value builtin_println_fn(const value *arguments) {
-	builtin_print_fn(arguments);
-
+	print_value(arguments[0]);
 	putchar('\n');
 
 	return VALUE_NULL;
 }
 
+static value builtin_flush_fn(const value *arguments) {
+	(void) arguments;
+
+	if (fflush(stdout))
+		die_with_stacktrace("unable to write output: %s", strerror(errno));
+
+	return VALUE_NULL;
+}
+
 static value builtin_random_fn(const value *arguments) {
 	(void) arguments;
 	number ret;
@@ -106,7 +346,7 @@ static value builtin_length_fn(const value *arguments) {
 		return new_number_value(as_array(arguments[0])->length);
 
 	case VALUE_KIND_STRING:
-		return new_number_value(as_string(arguments[0])->length);
+		return new_number_value(string_value_length(arguments[0]));
 
 	default:
 		die_with_stacktrace("can only get the length of arrays and strings, not %s", value_name(arguments[0]));
@@ -152,30 +392,236 @@ static value builtin_insert_fn(const value *arguments) {
 	return clone_value(arguments[0]);
 }
 
+static value builtin_slice_fn(const value *arguments) {
+	if (!is_number(arguments[1]) || !is_number(arguments[2])) {
+		die_with_stacktrace("the start and length for `slice` need to be integers, not %s and %s",
+			value_name(arguments[1]), value_name(arguments[2]));
+	}
+
+	unsigned source_length;
+
+	switch (classify(arguments[0])) {
+	case VALUE_KIND_STRING: source_length = string_value_length(arguments[0]); break;
+	case VALUE_KIND_ARRAY: source_length = as_array(arguments[0])->length; break;
+	default: die_with_stacktrace("can only `slice` strings and arrays, not %s", value_name(arguments[0]));
+	}
+
+	number start = as_number(arguments[1]);
+	number length = as_number(arguments[2]);
+
+	// Allow for negative starts, like indexing.
+	if (start < 0)
+		start += source_length;
+
+	if (start < 0 || length < 0 || source_length < start || source_length - start < length) {
+		die_with_stacktrace("slice of length %lld starting at %lld is out of bounds for length %u",
+			length, as_number(arguments[1]), source_length);
+	}
+
+	if (is_array(arguments[0]))
+		return new_array_value(slice_array(as_array(arguments[0]), start, length));
+
+	if (length <= SMALL_STRING_MAX_LENGTH) {
+		string_view view;
+		view_string_value(arguments[0], &view);
+		return new_small_string_value(view.ptr + start, length);
+	}
+
+	return new_string_value(slice_string(as_string(arguments[0]), start, length));
+}
+
 static value builtin_typeof_fn(const value *arguments) {
 	const char *typename = value_name(arguments[0]);
 
-	return new_string_value(new_string(strdup(typename), strlen(typename)));
+	return new_string_value_from_bytes(typename, strlen(typename));
+}
+
+static value builtin_intern_fn(const value *arguments) {
+	if (!is_string(arguments[0]))
+		die_with_stacktrace("can only intern strings, not %s", value_name(arguments[0]));
+
+	return intern_string_value(clone_value(arguments[0]));
 }
 
-#define BUILTIN_FN(name_, argc, fn) \
+// Returns `arguments[idx]` with its elements unboxed (see `unbox_numbers`), dying if it's not an
+// array of numbers.
+static array *number_array_argument(const value *arguments, unsigned idx, const char *name) {
+	if (!is_array(arguments[idx]))
+		die_with_stacktrace("can only `%s` arrays of numbers, not %s", name, value_name(arguments[idx]));
+
+	if (!unbox_numbers(as_array(arguments[idx])))
+		die_with_stacktrace("can only `%s` arrays of numbers, but the array had other values", name);
+
+	return as_array(arguments[idx]);
+}
+
+static array *allocate_number_array(unsigned length) {
+	return new_array(ARRAY_STRATEGY_NUMBERS, pool_alloc(length * sizeof(number)), length, length);
+}
+
+static value builtin_sum_fn(const value *arguments) {
+	array *ary = number_array_argument(arguments, 0, "sum");
+
+	return new_number_value(sum_numbers(ary->numbers, ary->length));
+}
+
+static value builtin_min_fn(const value *arguments) {
+	array *ary = number_array_argument(arguments, 0, "min");
+
+	return ary->length == 0 ? VALUE_NULL : new_number_value(min_numbers(ary->numbers, ary->length));
+}
+
+static value builtin_max_fn(const value *arguments) {
+	array *ary = number_array_argument(arguments, 0, "max");
+
+	return ary->length == 0 ? VALUE_NULL : new_number_value(max_numbers(ary->numbers, ary->length));
+}
+
+static value builtin_index_of_fn(const value *arguments) {
+	if (!is_array(arguments[0]))
+		die_with_stacktrace("can only `index_of` arrays, not %s", value_name(arguments[0]));
+
+	int idx = index_of_array(as_array(arguments[0]), arguments[1]);
+	return idx < 0 ? VALUE_NULL : new_number_value(idx);
+}
+
+static value builtin_count_fn(const value *arguments) {
+	if (!is_array(arguments[0]))
+		die_with_stacktrace("can only `count` arrays, not %s", value_name(arguments[0]));
+
+	return new_number_value(count_array(as_array(arguments[0]), arguments[1]));
+}
+
+static value builtin_add_arrays_fn(const value *arguments) {
+	array *lhs = number_array_argument(arguments, 0, "add_arrays");
+	array *rhs = number_array_argument(arguments, 1, "add_arrays");
+
+	if (lhs->length != rhs->length)
+		die_with_stacktrace("cannot `add_arrays` of lengths %u and %u", lhs->length, rhs->length);
+
+	array *ret = allocate_number_array(lhs->length);
+	add_numbers(ret->numbers, lhs->numbers, rhs->numbers, lhs->length);
+	return new_array_value(ret);
+}
+
+static value builtin_mul_arrays_fn(const value *arguments) {
+	array *lhs = number_array_argument(arguments, 0, "mul_arrays");
+	array *rhs = number_array_argument(arguments, 1, "mul_arrays");
+
+	if (lhs->length != rhs->length)
+		die_with_stacktrace("cannot `mul_arrays` of lengths %u and %u", lhs->length, rhs->length);
+
+	array *ret = allocate_number_array(lhs->length);
+	multiply_numbers(ret->numbers, lhs->numbers, rhs->numbers, lhs->length);
+	return new_array_value(ret);
+}
+
+static value builtin_fill_fn(const value *arguments) {
+	if (!is_array(arguments[0]))
+		die_with_stacktrace("can only `fill` arrays, not %s", value_name(arguments[0]));
+
+	fill_array(as_array(arguments[0]), arguments[1]);
+	return clone_value(arguments[0]);
+}
+
+static value builtin_range_fn(const value *arguments) {
+	if (!is_number(arguments[0]) || !is_number(arguments[1])) {
+		die_with_stacktrace("the start and end for `range` need to be integers, not %s and %s",
+			value_name(arguments[0]), value_name(arguments[1]));
+	}
+
+	number start = as_number(arguments[0]);
+	number end = as_number(arguments[1]);
+	number length = start < end ? end - start : 0;
+
+	if (UINT_MAX < length)
+		die_with_stacktrace("range from %lld to %lld is too long", start, end);
+
+	array *ret = allocate_number_array(length);
+	range_numbers(ret->numbers, length, start);
+	return new_array_value(ret);
+}
+
+// Returns the array that `sort` and `sort_by` should sort. If nothing else refers to `ary`, then no
+// one else can see it being changed, so it's sorted in place; otherwise, a copy is.
+static array *array_to_sort(value ary, const char *name) {
+	if (!is_array(ary))
+		die_with_stacktrace("can only `%s` arrays, not %s", name, value_name(ary));
+
+	if (as_array(ary)->refcount == 1)
+		return clone_array(as_array(ary));
+
+	return copy_array(as_array(ary));
+}
+
+static value builtin_sort_fn(const value *arguments) {
+	array *ary = array_to_sort(arguments[0], "sort");
+
+	sort_array(ary, NULL, NULL);
+	return new_array_value(ary);
+}
+
+static int compare_with_function(value lhs, value rhs, void *context) {
+	value arguments[2] = { lhs, rhs };
+	value result = call_value(*(const value *) context, 2, arguments);
+
+	if (!is_number(result)) {
+		die_with_stacktrace("`sort_by` functions must return a negative, zero, or positive number, not %s",
+			value_name(result));
+	}
+
+	return (as_number(result) > 0) - (as_number(result) < 0);
+}
+
+static value builtin_sort_by_fn(const value *arguments) {
+	array *ary = array_to_sort(arguments[0], "sort_by");
+
+	sort_array(ary, compare_with_function, (void *) &arguments[1]);
+	return new_array_value(ary);
+}
+
+#define BUILTIN_FN_(name_, argc, fn, replaceable_) \
 	(builtin_function) { \
 		.name = name_, \
 		.required_argument_count = argc, \
-		.function_pointer = fn \
+		.function_pointer = fn, \
+		.replaceable = replaceable_ \
 	}
 
+#define BUILTIN_FN(name_, argc, fn) BUILTIN_FN_(name_, argc, fn, false)
+
+// Builtins that programs written before them may have already defined themselves.
+#define REPLACEABLE_BUILTIN_FN(name_, argc, fn) BUILTIN_FN_(name_, argc, fn, true)
+
 builtin_function builtin_functions[] = {
 	BUILTIN_FN("to_num", 1, builtin_to_num_fn),
 	BUILTIN_FN("prompt", 0, builtin_prompt_fn),
+	REPLACEABLE_BUILTIN_FN("read_lines", 0, builtin_read_lines_fn),
+	REPLACEABLE_BUILTIN_FN("read_all", 0, builtin_read_all_fn),
+	REPLACEABLE_BUILTIN_FN("read_file", 1, builtin_read_file_fn),
+	REPLACEABLE_BUILTIN_FN("open_mapped", 1, builtin_open_mapped_fn),
 	BUILTIN_FN("print", 1, builtin_print_fn),
 	BUILTIN_FN("println", 1, builtin_println_fn),
+	REPLACEABLE_BUILTIN_FN("flush", 0, builtin_flush_fn),
 	BUILTIN_FN("random", 0, builtin_random_fn),
 	BUILTIN_FN("length", 1, builtin_length_fn),
 	BUILTIN_FN("exit", 1, builtin_exit_fn),
 	BUILTIN_FN("dump", 1, builtin_dump_fn),
 	BUILTIN_FN("delete", 2, builtin_delete_fn),
 	BUILTIN_FN("insert", 3, builtin_insert_fn),
+	REPLACEABLE_BUILTIN_FN("slice", 3, builtin_slice_fn),
+	REPLACEABLE_BUILTIN_FN("sum", 1, builtin_sum_fn),
+	REPLACEABLE_BUILTIN_FN("min", 1, builtin_min_fn),
+	REPLACEABLE_BUILTIN_FN("max", 1, builtin_max_fn),
+	REPLACEABLE_BUILTIN_FN("index_of", 2, builtin_index_of_fn),
+	REPLACEABLE_BUILTIN_FN("count", 2, builtin_count_fn),
+	REPLACEABLE_BUILTIN_FN("add_arrays", 2, builtin_add_arrays_fn),
+	REPLACEABLE_BUILTIN_FN("mul_arrays", 2, builtin_mul_arrays_fn),
+	REPLACEABLE_BUILTIN_FN("fill", 2, builtin_fill_fn),
+	REPLACEABLE_BUILTIN_FN("range", 2, builtin_range_fn),
+	REPLACEABLE_BUILTIN_FN("sort", 1, builtin_sort_fn),
+	REPLACEABLE_BUILTIN_FN("sort_by", 2, builtin_sort_by_fn),
 	BUILTIN_FN("typeof", 1, builtin_typeof_fn),
+	REPLACEABLE_BUILTIN_FN("intern", 1, builtin_intern_fn),
 };
 
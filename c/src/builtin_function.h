@@ -2,14 +2,20 @@
 
 #include "valuedefn.h"
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct {
 	VALUE_ALIGNMENT const char *name;
 	unsigned required_argument_count;
 	value (*function_pointer)(const value *arguments);
+
+	// Whether a program can define its own function with this name, replacing the builtin. This is
+	// only allowed for newer builtins, so that adding them doesn't break programs which already
+	// define a function with the same name.
+	bool replaceable;
 } builtin_function;
 
-#define NUMBER_OF_BUILTIN_FUNCTIONS 11
+#define NUMBER_OF_BUILTIN_FUNCTIONS 29
 extern builtin_function builtin_functions[NUMBER_OF_BUILTIN_FUNCTIONS];
 
 void init_builtin_functions(void);
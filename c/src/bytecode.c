@@ -7,6 +7,7 @@ const char *opcode_repr(opcode op) {
 
 	case OPCODE_LOAD_CONSTANT:         return "LOAD_CONSTANT";
 	case OPCODE_LOAD_GLOBAL_VARIABLE:  return "LOAD_GLOBAL_VARIABLE";
+	case OPCODE_TAKE_GLOBAL_VARIABLE:  return "TAKE_GLOBAL_VARIABLE";
 	case OPCODE_STORE_GLOBAL_VARIABLE: return "STORE_GLOBAL_VARIABLE";
 
 	case OPCODE_JUMP:          return "JUMP";
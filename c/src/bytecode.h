@@ -6,6 +6,7 @@ typedef enum {
 
 	OPCODE_LOAD_CONSTANT,
 	OPCODE_LOAD_GLOBAL_VARIABLE,
+	OPCODE_TAKE_GLOBAL_VARIABLE,
 	OPCODE_STORE_GLOBAL_VARIABLE,
 
 	OPCODE_JUMP,
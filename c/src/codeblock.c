@@ -52,16 +52,26 @@ static opcode next_opcode(virtual_machine *vm) {
 
 static value next_local(virtual_machine *vm) {
 	unsigned count = vm->block->code[vm->instruction_pointer].count;
+	bool move_out = count & CODEBLOCK_MOVE_LOCAL_FLAG;
+	count &= ~CODEBLOCK_MOVE_LOCAL_FLAG;
+
 	value local = vm->locals[count];
-	assert(local != VALUE_UNDEFINED); // This means we're reading from an unset local.
+	assert(local != VALUE_UNDEFINED); // This means we're reading from an unset (or moved-out) local.
 
 #ifdef ENABLE_LOGGING
-	LOGN("vm[% 3d] = local(%d) {", vm->instruction_pointer, count);
+	LOGN("vm[% 3d] = local(%d%s) {", vm->instruction_pointer, count, move_out ? ", move" : "");
 	dump_value(stdout, local);
 	putchar('}');
 #endif
 
 	vm->instruction_pointer++;
+
+	// This is the last use of the local, so we can just take its value instead of cloning it.
+	if (move_out) {
+		vm->locals[count] = VALUE_UNDEFINED;
+		return local;
+	}
+
 	return clone_value(local);
 }
 
@@ -114,6 +124,12 @@ static void run_load_global_variable(virtual_machine *vm) {
 	set_next_local(vm, fetch_global_variable(global_index));
 }
 
+static void run_take_global_variable(virtual_machine *vm) {
+	unsigned global_index = next_count(vm);
+
+	set_next_local(vm, take_global_variable(global_index));
+}
+
 static void run_store_global_variable(virtual_machine *vm) {
 	unsigned global_index = next_count(vm);
 	value value = next_local(vm);
@@ -180,9 +196,10 @@ static void run_add(virtual_machine *vm) {
 	value lhs = next_local(vm);
 	value rhs = next_local(vm);
 
-	set_next_local(vm, add_values(lhs, rhs));
+	// `lhs` is handed off, so that if this was its last reference (eg `str = str + x` or `str += x`)
+	// it can be appended to in place.
+	set_next_local(vm, add_values_in_place(lhs, rhs));
 
-	free_value(lhs);
 	free_value(rhs);
 }
 
@@ -317,6 +334,7 @@ static void run_vm(virtual_machine *vm) {
 
 		case OPCODE_LOAD_CONSTANT:         run_load_constant(vm); break;
 		case OPCODE_LOAD_GLOBAL_VARIABLE:  run_load_global_variable(vm); break;
+		case OPCODE_TAKE_GLOBAL_VARIABLE:  run_take_global_variable(vm); break;
 		case OPCODE_STORE_GLOBAL_VARIABLE: run_store_global_variable(vm); break;
 
 		case OPCODE_JUMP_IF_TRUE:  run_jump_if_true(vm); break;
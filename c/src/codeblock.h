@@ -5,6 +5,11 @@
 
 #define CODEBLOCK_RETURN_LOCAL 0
 
+// Set on a local operand when the compiler has proven it's the last use of that local's value. The
+// VM then moves the value out of the local (leaving it undefined) instead of cloning it, which keeps
+// refcounts low enough for the in-place fast paths to apply.
+#define CODEBLOCK_MOVE_LOCAL_FLAG 0x80000000u
+
 typedef struct {
 	unsigned number_of_locals, code_length, number_of_constants;
 	bytecode *code;
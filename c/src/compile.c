@@ -6,10 +6,35 @@
 #include "value.h"
 #include "ast.h"
 #include "globals.h"
+#include "index_table.h"
 #include <stdlib.h>
 #include <string.h>
-
-#define parse_error(...) die(__VA_ARGS__)
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+struct pending_function;
+static _Thread_local struct pending_function *pending_function_being_compiled;
+static _Noreturn void fail_pending_function(const char *fmt, ...);
+
+// Function bodies that are being compiled on other threads can't just `die`, as other threads might
+// be doing the same at the same time, so their errors are recorded and reported once every thread's
+// done (see `compile_pending_functions`).
+#define parse_error(...) (pending_function_being_compiled != NULL \
+	? fail_pending_function(__VA_ARGS__) \
+	: die(__VA_ARGS__))
+
+struct compile_options compile_options = {
+	.streaming = false,
+	.report_module_times = false,
+	.threads = 1,
+	.lazy = false,
+};
 
 // Since we discard all locals after returning, we can use the return local as scratch.
 #define SCRATCH_LOCAL CODEBLOCK_RETURN_LOCAL
@@ -25,22 +50,26 @@
 # define MAX_NUMBER_OF_BREAKS_PER_WHILE 64
 #endif
 
-typedef struct {
-	char *name;
-	unsigned local_index;
-} local_variable_entry;
+struct codeblock_builder {
+	// Maps the (interned) names of local variables to their indices.
+	index_table local_variables;
 
-typedef struct {
-	struct {
-		unsigned length, capacity;
-		local_variable_entry *entries;
-	} local_variables;
+	// Only the globals that were declared before the function can be used, even if its body is compiled
+	// later on (eg on another thread), so that every way of compiling accepts the same programs.
+	unsigned number_of_visible_globals;
 
 	unsigned number_of_locals;
 
 	struct {
 		unsigned length, capacity;
 		value *consts;
+		index_table indices; // Maps each constant to its index in `consts`.
+
+		// References to constants that were already in `consts`. Freeing a value touches its refcount,
+		// which isn't safe while other threads are compiling, so these are freed once the function's
+		// installed.
+		unsigned number_of_duplicates, duplicates_capacity;
+		value *duplicates;
 	} constants;
 
 	struct {
@@ -48,7 +77,9 @@ typedef struct {
 		bytecode *code;
 	} bytecode;
 
-	struct {
+	// This is a few kilobytes, and lots of builders can be waiting to be compiled at once (see
+	// `compile_options.threads`), so it's only allocated when the function's first loop is compiled.
+	struct whiles {
 		unsigned length;
 		unsigned start_of_conditions[MAX_NUMBER_OF_NESTED_WHILES];
 
@@ -56,8 +87,8 @@ typedef struct {
 			unsigned length;
 			unsigned code_positions[MAX_NUMBER_OF_BREAKS_PER_WHILE];
 		} breaks[MAX_NUMBER_OF_NESTED_WHILES];
-	} whiles;
-} codeblock_builder;
+	} *whiles;
+};
 
 static unsigned next_local_index(codeblock_builder *builder) {
 	unsigned local_index = builder->number_of_locals;
@@ -65,46 +96,34 @@ static unsigned next_local_index(codeblock_builder *builder) {
 	return local_index;
 }
 
-static unsigned declare_local_variable(codeblock_builder *builder, char *name) {
+static unsigned declare_local_variable(codeblock_builder *builder, const char *name) {
 	// Check to see if the variable's been used before
-	for (unsigned i = 0; i < builder->local_variables.length; i++) {
-		if (!strcmp(builder->local_variables.entries[i].name, name)) {
-			free(name);
-			// It has, return that index.
-			return builder->local_variables.entries[i].local_index;
-		}
-	}
+	int previous_index = lookup_index(&builder->local_variables, (uintptr_t) name);
+	if (previous_index != INDEX_TABLE_MISSING)
+		return previous_index;
 
 	// We haven't seen the variable before, let's add it.
-
-	if (builder->local_variables.length == builder->local_variables.capacity) {
-		builder->local_variables.capacity *= 2;
-		builder->local_variables.entries = xrealloc(
-			builder->local_variables.entries,
-			builder->local_variables.capacity * sizeof(local_variable_entry)
-		);
-	}
-
 	unsigned local_index = next_local_index(builder);
-
-	builder->local_variables.entries[builder->local_variables.length].name = name;
-	builder->local_variables.entries[builder->local_variables.length].local_index = local_index;
+	insert_index(&builder->local_variables, (uintptr_t) name, local_index);
 
 	LOG("locals[%d] = %s\n", local_index, name);
 
-	builder->local_variables.length++;
 	return local_index;
 }
 
-#define VARIABLE_DOESNT_EXIST (-1)
+#define VARIABLE_DOESNT_EXIST INDEX_TABLE_MISSING
 
 static int lookup_local_variable(codeblock_builder *builder, const char *name) {
-	for (unsigned i = 0; i < builder->local_variables.length; i++) {
-		if (!strcmp(builder->local_variables.entries[i].name, name))
-			return builder->local_variables.entries[i].local_index;
-	}
+	return lookup_index(&builder->local_variables, (uintptr_t) name);
+}
+
+static int lookup_visible_global_variable(unsigned number_of_visible_globals, const char *name) {
+	int global_index = lookup_global_variable(name);
+
+	if (global_index == GLOBAL_DOESNT_EXIST || number_of_visible_globals <= (unsigned) global_index)
+		return GLOBAL_DOESNT_EXIST;
 
-	return VARIABLE_DOESNT_EXIST;
+	return global_index;
 }
 
 static void set_bytecode(codeblock_builder *builder, bytecode bc) {
@@ -150,15 +169,20 @@ static void set_jump_dst(codeblock_builder *builder, unsigned jmp_src) {
 }
 
 static void load_constant(codeblock_builder *builder, value constant, unsigned target_local) {
-	unsigned constant_index;
-
-	// If the constant already exists, then we don't need to store it again.
-	for (unsigned i = 0; i < builder->constants.length; i++) {
-		if (equate_values(builder->constants.consts[i], constant)) {
-			constant_index = i;
-			free_value(constant);
-			goto found_constant;
+	// If the constant already exists, then we don't need to store it again. Constants are either
+	// immediates or interned strings, so equal constants are always identical.
+	int constant_index = lookup_index(&builder->constants.indices, constant);
+	if (constant_index != INDEX_TABLE_MISSING) {
+		if (builder->constants.number_of_duplicates == builder->constants.duplicates_capacity) {
+			builder->constants.duplicates_capacity = builder->constants.duplicates_capacity * 2 + 4;
+			builder->constants.duplicates = xrealloc(
+				builder->constants.duplicates,
+				builder->constants.duplicates_capacity * sizeof(value)
+			);
 		}
+
+		builder->constants.duplicates[builder->constants.number_of_duplicates++] = constant;
+		goto found_constant;
 	}
 
 	// We didn't find it, we need to allocate it.
@@ -173,6 +197,7 @@ static void load_constant(codeblock_builder *builder, value constant, unsigned t
 	constant_index = builder->constants.length;
 	builder->constants.consts[constant_index] = constant;
 	builder->constants.length++;
+	insert_index(&builder->constants.indices, constant, constant_index);
 
 found_constant:
 
@@ -208,7 +233,6 @@ static void compile_primary(codeblock_builder *builder, ast_primary *primary, un
 			argument_locals[i] = next_local_index(builder);
 			compile_expression(builder, primary->function_call.arguments[i], argument_locals[i]);
 		}
-		free(primary->function_call.arguments);
 
 		set_opcode(builder, OPCODE_CALL);
 		set_local(builder, function_local);
@@ -243,7 +267,6 @@ static void compile_primary(codeblock_builder *builder, ast_primary *primary, un
 			element_locals[i] = next_local_index(builder);
 			compile_expression(builder, primary->array_literal.elements[i], element_locals[i]);
 		}
-		free(primary->array_literal.elements);
 
 		set_opcode(builder, OPCODE_ARRAY_LITERAL);
 		set_count(builder, primary->array_literal.length);
@@ -259,19 +282,16 @@ static void compile_primary(codeblock_builder *builder, ast_primary *primary, un
 		int local_index = lookup_local_variable(builder, primary->variable.name);
 
 		if (local_index != VARIABLE_DOESNT_EXIST) {
-			free(primary->variable.name);
-
 			set_opcode(builder, OPCODE_MOVE);
 			set_local(builder, local_index);
 			set_local(builder, target_local);
 			break;
 		}
 
-		int global_index = lookup_global_variable(primary->variable.name);
+		int global_index = lookup_visible_global_variable(builder->number_of_visible_globals, primary->variable.name);
 
 		if (global_index == GLOBAL_DOESNT_EXIST)
 			parse_error("undeclared variable '%s'", primary->variable.name);
-		free(primary->variable.name);
 
 		set_opcode(builder, OPCODE_LOAD_GLOBAL_VARIABLE);
 		set_count(builder, global_index);
@@ -283,8 +303,6 @@ static void compile_primary(codeblock_builder *builder, ast_primary *primary, un
 		load_constant(builder, primary->literal.val, target_local);
 		break;
 	}
-
-	free(primary);
 }
 
 static opcode binary_operator_to_opcode(binary_operator operator) {
@@ -311,8 +329,6 @@ static void compile_expression(codeblock_builder *builder, ast_expression *expre
 
 		int local_index = lookup_local_variable(builder, expression->assign.name);
 		if (local_index != VARIABLE_DOESNT_EXIST) {
-			free(expression->assign.name);
-
 			if (expression->assign.operator != BINARY_OP_UNDEF) {
 				set_opcode(builder, binary_operator_to_opcode(expression->assign.operator));
 				set_local(builder, local_index);
@@ -326,27 +342,28 @@ static void compile_expression(codeblock_builder *builder, ast_expression *expre
 			break;
 		}
 
-		int global_index = lookup_global_variable(expression->assign.name);
+		int global_index = lookup_visible_global_variable(builder->number_of_visible_globals, expression->assign.name);
 		if (global_index == GLOBAL_DOESNT_EXIST) {
 			parse_error("unknown variable '%s'; declare it first.", expression->assign.name);
 		}
 
-		free(expression->assign.name);
-
 		if (expression->assign.operator != BINARY_OP_UNDEF) {
+			// The global's about to be overwritten, and nothing can observe it in the meantime, so we
+			// take its value rather than cloning it. That way, if the global was the only reference
+			// (eg `acc += [x]`), the operator can update it in place.
 			unsigned old_local_index = next_local_index(builder);
-			set_opcode(builder, OPCODE_LOAD_GLOBAL_VARIABLE);
+			set_opcode(builder, OPCODE_TAKE_GLOBAL_VARIABLE);
 			set_count(builder, global_index);
 			set_local(builder, old_local_index);
 
 			set_opcode(builder, binary_operator_to_opcode(expression->assign.operator));
 			set_local(builder, old_local_index);
 			set_local(builder, target_local);
-			set_local(builder, old_local_index);
+			set_local(builder, target_local);
 		}
 
 		set_opcode(builder, OPCODE_STORE_GLOBAL_VARIABLE);
-		set_local(builder, global_index);
+		set_count(builder, global_index);
 		set_local(builder, target_local);
 		set_local(builder, target_local);
 		break;
@@ -417,12 +434,88 @@ static void compile_expression(codeblock_builder *builder, ast_expression *expre
 		compile_primary(builder, expression->primary, target_local);
 		break;
 	}
-
-	free(expression);
 }
 
 static void compile_block(codeblock_builder *builder, ast_block *block);
-static void compile_statement(codeblock_builder *builder, ast_statement *statement) {
+
+unsigned compile_if_condition(codeblock_builder *builder, ast_expression *condition) {
+	compile_expression(builder, condition, SCRATCH_LOCAL);
+	set_opcode(builder, OPCODE_JUMP_IF_FALSE);
+	set_local(builder, SCRATCH_LOCAL);
+	return defer_jump(builder);
+}
+
+unsigned compile_else(codeblock_builder *builder, unsigned if_false_jump) {
+	set_opcode(builder, OPCODE_JUMP);
+	unsigned if_true_jump_to_end = defer_jump(builder);
+
+	set_jump_dst(builder, if_false_jump);
+	return if_true_jump_to_end;
+}
+
+void compile_end_if(codeblock_builder *builder, unsigned pending_jump) {
+	set_jump_dst(builder, pending_jump);
+}
+
+// Starts a loop whose condition begins at `beginning_of_condition`, returning the jump to its end.
+static unsigned begin_loop(codeblock_builder *builder, unsigned beginning_of_condition, const char *kind) {
+	set_opcode(builder, OPCODE_JUMP_IF_FALSE);
+	set_local(builder, SCRATCH_LOCAL);
+	unsigned jump_to_end = defer_jump(builder);
+
+	if (builder->whiles == NULL) {
+		builder->whiles = xmalloc(sizeof(struct whiles));
+		builder->whiles->length = 0;
+	}
+
+	if (builder->whiles->length == MAX_NUMBER_OF_NESTED_WHILES)
+		parse_error("too many nested %ss encountered; only %d max allowed", kind, MAX_NUMBER_OF_NESTED_WHILES);
+
+	builder->whiles->start_of_conditions[builder->whiles->length] = beginning_of_condition;
+	builder->whiles->breaks[builder->whiles->length].length = 0;
+	builder->whiles->length++;
+
+	return jump_to_end;
+}
+
+unsigned compile_while_condition(codeblock_builder *builder, ast_expression *condition) {
+	unsigned beginning_of_condition = builder->bytecode.length;
+	compile_expression(builder, condition, SCRATCH_LOCAL);
+
+	return begin_loop(builder, beginning_of_condition, "while");
+}
+
+unsigned compile_for_header(
+	codeblock_builder *builder,
+	ast_statement *initializer,
+	ast_expression *condition,
+	ast_expression *updator
+) {
+	compile_statement(builder, initializer);
+	set_opcode(builder, OPCODE_JUMP);
+	unsigned jump_to_condition = defer_jump(builder);
+
+	unsigned beginning_of_condition = builder->bytecode.length;
+	compile_expression(builder, updator, SCRATCH_LOCAL);
+	set_jump_dst(builder, jump_to_condition);
+
+	compile_expression(builder, condition, SCRATCH_LOCAL);
+
+	return begin_loop(builder, beginning_of_condition, "for");
+}
+
+void compile_end_loop(codeblock_builder *builder, unsigned jump_to_end) {
+	builder->whiles->length--;
+
+	set_opcode(builder, OPCODE_JUMP);
+	set_count(builder, builder->whiles->start_of_conditions[builder->whiles->length]);
+	set_jump_dst(builder, jump_to_end);
+
+	for (unsigned i = 0; i < builder->whiles->breaks[builder->whiles->length].length; i++)
+		set_jump_dst(builder, builder->whiles->breaks[builder->whiles->length].code_positions[i]);
+}
+
+void compile_statement(codeblock_builder *builder, ast_statement *statement) {
 	switch (statement->kind) {
 	case AST_STATEMENT_LOCAL: {
 		unsigned new_local = declare_local_variable(builder, statement->local.name);
@@ -447,91 +540,43 @@ static void compile_statement(codeblock_builder *builder, ast_statement *stateme
 		set_opcode(builder, OPCODE_RETURN);
 		break;
 
-	case AST_STATEMENT_IF:
-		compile_expression(builder, statement->if_.condition, SCRATCH_LOCAL);
-		set_opcode(builder, OPCODE_JUMP_IF_FALSE);
-		set_local(builder, SCRATCH_LOCAL);
-		unsigned if_false_jump = defer_jump(builder);
-
+	case AST_STATEMENT_IF: {
+		unsigned pending_jump = compile_if_condition(builder, statement->if_.condition);
 		compile_block(builder, statement->if_.if_true);
 
-		if (statement->if_.if_false == NULL) {
-			set_jump_dst(builder, if_false_jump);
-		} else {
-			set_opcode(builder, OPCODE_JUMP);
-			unsigned if_true_jump_to_end = defer_jump(builder);
-
-			set_jump_dst(builder, if_false_jump);
+		if (statement->if_.if_false != NULL) {
+			pending_jump = compile_else(builder, pending_jump);
 			compile_block(builder, statement->if_.if_false);
-
-			set_jump_dst(builder, if_true_jump_to_end);
 		}
+
+		compile_end_if(builder, pending_jump);
 		break;
+	}
 
 	case AST_STATEMENT_WHILE: {
-		unsigned beginning_of_condition = builder->bytecode.length;
-		compile_expression(builder, statement->while_.condition, SCRATCH_LOCAL);
-		set_opcode(builder, OPCODE_JUMP_IF_FALSE);
-		set_local(builder, SCRATCH_LOCAL);
-		unsigned jump_to_while_end = defer_jump(builder);
-
-		if (builder->whiles.length == MAX_NUMBER_OF_NESTED_WHILES)
-			parse_error("too many nested whiles encountered; only %d max allowed", MAX_NUMBER_OF_NESTED_WHILES);
-
-		builder->whiles.start_of_conditions[builder->whiles.length] = beginning_of_condition;
-		builder->whiles.breaks[builder->whiles.length].length = 0;
-		builder->whiles.length++;
+		unsigned jump_to_end = compile_while_condition(builder, statement->while_.condition);
 		compile_block(builder, statement->while_.body);
-
-		set_opcode(builder, OPCODE_JUMP);
-		set_count(builder, beginning_of_condition);
-		set_jump_dst(builder, jump_to_while_end);
-
-		builder->whiles.length--;
-		for (unsigned i = 0; i < builder->whiles.breaks[builder->whiles.length].length; i++)
-			set_jump_dst(builder, builder->whiles.breaks[builder->whiles.length].code_positions[i]);
-
+		compile_end_loop(builder, jump_to_end);
 		break;
 	}
 
-		case AST_STATEMENT_FOR: {
-		compile_statement(builder, statement->for_.initializer);
-		set_opcode(builder, OPCODE_JUMP);
-		unsigned jump_to_condition = defer_jump(builder);
-
-		unsigned beginning_of_condition = builder->bytecode.length;
-		compile_expression(builder, statement->for_.updator, SCRATCH_LOCAL);
-		set_jump_dst(builder, jump_to_condition);
-
-		compile_expression(builder, statement->for_.condition, SCRATCH_LOCAL);
-		set_opcode(builder, OPCODE_JUMP_IF_FALSE);
-		set_local(builder, SCRATCH_LOCAL);
-		unsigned jump_to_for_end = defer_jump(builder);
-
-		if (builder->whiles.length == MAX_NUMBER_OF_NESTED_WHILES)
-			parse_error("too many nested fors encountered; only %d max allowed", MAX_NUMBER_OF_NESTED_WHILES);
-
-		builder->whiles.start_of_conditions[builder->whiles.length] = beginning_of_condition;
-		builder->whiles.breaks[builder->whiles.length].length = 0;
-		builder->whiles.length++;
+	case AST_STATEMENT_FOR: {
+		unsigned jump_to_end = compile_for_header(
+			builder,
+			statement->for_.initializer,
+			statement->for_.condition,
+			statement->for_.updator
+		);
 		compile_block(builder, statement->for_.body);
-
-		set_opcode(builder, OPCODE_JUMP);
-		set_count(builder, beginning_of_condition);
-		set_jump_dst(builder, jump_to_for_end);
-
-		builder->whiles.length--;
-		for (unsigned i = 0; i < builder->whiles.breaks[builder->whiles.length].length; i++)
-			set_jump_dst(builder, builder->whiles.breaks[builder->whiles.length].code_positions[i]);
-
+		compile_end_loop(builder, jump_to_end);
 		break;
 	}
 
 	case AST_STATEMENT_BREAK:
-		if (builder->whiles.length == 0)
+		if (builder->whiles == NULL || builder->whiles->length == 0)
 			parse_error("cannot break when not within a while");
 
-		struct _each_while_break *breaks = &builder->whiles.breaks[builder->whiles.length - 1];
+		struct _each_while_break *breaks = &builder->whiles->breaks[builder->whiles->length - 1];
 
 		if (breaks->length == MAX_NUMBER_OF_BREAKS_PER_WHILE) {
 			parse_error(
@@ -546,132 +591,847 @@ static void compile_statement(codeblock_builder *builder, ast_statement *stateme
 		break;
 
 	case AST_STATEMENT_CONTINUE:
-		if (builder->whiles.length == 0)
+		if (builder->whiles == NULL || builder->whiles->length == 0)
 			parse_error("cannot continue when not within a while");
 
 		set_opcode(builder, OPCODE_JUMP);
-		set_count(builder, builder->whiles.start_of_conditions[builder->whiles.length - 1]);
+		set_count(builder, builder->whiles->start_of_conditions[builder->whiles->length - 1]);
 		break;
 
 	case AST_STATEMENT_EXPRESSION:
 		compile_expression(builder, statement->expression, SCRATCH_LOCAL);
 		break;
 	}
-
-	free(statement);
 }
 
 static void compile_block(codeblock_builder *builder, ast_block *block) {
 	for (unsigned i = 0; i < block->number_of_statements; i++)
 		compile_statement(builder, block->statements[i]);
+}
+
+/*
+ * Last-use analysis.
+ *
+ * Once a function's bytecode is built, we run a classic backwards liveness analysis over it to find
+ * each read of a local after which that local's current value is never read again. Those operands
+ * are tagged with `CODEBLOCK_MOVE_LOCAL_FLAG`, so the VM moves the value out rather than cloning it.
+ * Without this, every temporary (and every variable's final value) keeps an extra reference around
+ * until `run_codeblock` frees all the locals on exit.
+ */
+typedef enum {
+	OPERAND_OPCODE,
+	OPERAND_COUNT,
+	OPERAND_JUMP_TARGET,
+	OPERAND_READ_LOCAL,
+	OPERAND_WRITE_LOCAL,
+} operand_kind;
+
+// Fills in `kinds` for each bytecode of the instruction starting at `start`, returning the start of
+// the next instruction.
+static unsigned classify_operands(const bytecode *code, unsigned start, operand_kind *kinds) {
+	unsigned ip = start;
+	kinds[ip++] = OPERAND_OPCODE;
+
+	switch (code[start].op) {
+	case OPCODE_MOVE:
+	case OPCODE_NOT:
+	case OPCODE_NEGATE:
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+
+	case OPCODE_ARRAY_LITERAL: {
+		unsigned length = code[ip].count;
+		kinds[ip++] = OPERAND_COUNT;
+
+		for (unsigned i = 0; i < length; i++)
+			kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+	}
+
+	case OPCODE_LOAD_CONSTANT:
+	case OPCODE_LOAD_GLOBAL_VARIABLE:
+	case OPCODE_TAKE_GLOBAL_VARIABLE:
+		kinds[ip++] = OPERAND_COUNT;
+		break;
+
+	case OPCODE_STORE_GLOBAL_VARIABLE:
+		kinds[ip++] = OPERAND_COUNT;
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+
+	case OPCODE_JUMP:
+		kinds[ip++] = OPERAND_JUMP_TARGET;
+		return ip;
+
+	case OPCODE_JUMP_IF_TRUE:
+	case OPCODE_JUMP_IF_FALSE:
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		kinds[ip++] = OPERAND_JUMP_TARGET;
+		return ip;
 
-	free(block->statements);
-	free(block);
+	case OPCODE_CALL: {
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		unsigned number_of_arguments = code[ip].count;
+		kinds[ip++] = OPERAND_COUNT;
+
+		for (unsigned i = 0; i < number_of_arguments; i++)
+			kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+	}
+
+	case OPCODE_RETURN:
+		return ip;
+
+	case OPCODE_ADD:
+	case OPCODE_SUBTRACT:
+	case OPCODE_MULTIPLY:
+	case OPCODE_DIVIDE:
+	case OPCODE_MODULO:
+	case OPCODE_EQUAL:
+	case OPCODE_NOT_EQUAL:
+	case OPCODE_LESS_THAN:
+	case OPCODE_LESS_THAN_OR_EQUAL:
+	case OPCODE_GREATER_THAN:
+	case OPCODE_GREATER_THAN_OR_EQUAL:
+	case OPCODE_INDEX:
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+
+	case OPCODE_INDEX_ASSIGN:
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		kinds[ip++] = OPERAND_READ_LOCAL;
+		break;
+	}
+
+	// Everything that doesn't return early ends with its destination local.
+	kinds[ip++] = OPERAND_WRITE_LOCAL;
+	return ip;
 }
 
-static function *build_function(
-	char *function_name,
-	unsigned number_of_arguments,
-	char **argument_names,
-	ast_block *body,
-	const char *source_filename,
-	unsigned source_line_number
-) {
-	codeblock_builder builder;
+#define IS_LIVE(set, local) ((set)[(local) / 8] & (1 << ((local) % 8)))
+#define SET_LIVE(set, local) ((set)[(local) / 8] |= (1 << ((local) % 8)))
+#define CLEAR_LIVE(set, local) ((set)[(local) / 8] &= ~(1 << ((local) % 8)))
 
-	builder.local_variables.length = 0;
-	builder.local_variables.capacity = 4;
-	builder.local_variables.entries = xmalloc(
-		builder.local_variables.capacity * sizeof(local_variable_entry)
-	);
+#define NOT_TRACKED (~0u)
+
+// Functions can have tens of thousands of locals (every temporary gets its own), so keeping a set of
+// every local for every instruction would be quadratic. Instead, the analysis is done on basic blocks,
+// and only "tracked" locals (ones which are read in some block before being written in it, and thus
+// might be live when entering a block) are kept in the per-block sets. Every other local is only ever
+// live inside a single block, so it's handled during that block's backwards scan.
+typedef struct {
+	const bytecode *code;
+	operand_kind *kinds;
+	unsigned code_length;
+
+	// Blocks are in code order; `block_starts[number_of_blocks]` is `code_length`. `block_at` maps
+	// the start of each block to its index.
+	unsigned number_of_blocks, *block_starts, *block_at;
+
+	unsigned *tracked_index; // The index of each local within the sets, or `NOT_TRACKED`.
+	unsigned set_bytes;
+	unsigned char *live_in; // `live_in[block]` is the set of tracked locals live when entering it.
+} liveness;
+
+// Returns the start of the instruction containing `ip`, which must be within `block`.
+static unsigned last_instruction_of(const liveness *lv, unsigned block) {
+	unsigned ip = lv->block_starts[block + 1] - 1;
+
+	while (lv->kinds[ip] != OPERAND_OPCODE)
+		ip--;
+
+	return ip;
+}
+
+// Sets `live` to the tracked locals live when leaving `block`.
+static void live_out_of_block(const liveness *lv, unsigned block, unsigned char *live) {
+	memset(live, 0, lv->set_bytes);
+
+	unsigned last = last_instruction_of(lv, block);
+	opcode op = lv->code[last].op;
+	unsigned end = lv->block_starts[block + 1];
+
+	if (op == OPCODE_RETURN)
+		return;
+
+	if (op != OPCODE_JUMP && end != lv->code_length)
+		memcpy(live, &lv->live_in[(block + 1) * lv->set_bytes], lv->set_bytes);
+
+	if (lv->kinds[end - 1] == OPERAND_JUMP_TARGET && lv->code[end - 1].count != lv->code_length) {
+		const unsigned char *target = &lv->live_in[lv->block_at[lv->code[end - 1].count] * lv->set_bytes];
+
+		for (unsigned i = 0; i < lv->set_bytes; i++)
+			live[i] |= target[i];
+	}
+}
+
+static void mark_last_uses(codeblock_builder *builder) {
+	bytecode *code = builder->bytecode.code;
+	unsigned code_length = builder->bytecode.length;
+	unsigned number_of_locals = builder->number_of_locals;
+
+	liveness lv = {
+		.code = code,
+		.code_length = code_length,
+		.kinds = xmalloc(code_length * sizeof(operand_kind)),
+		.block_starts = xmalloc((code_length + 1) * sizeof(unsigned)),
+		.block_at = xmalloc((code_length + 1) * sizeof(unsigned)),
+		.tracked_index = xmalloc(number_of_locals * sizeof(unsigned)),
+		.number_of_blocks = 0,
+	};
+
+	// Find where blocks start: at the beginning, at jump targets, and after jumps and returns.
+	unsigned char *is_block_start = xmalloc(code_length + 1);
+	memset(is_block_start, 0, code_length + 1);
+	is_block_start[0] = true;
+
+	for (unsigned ip = 0; ip < code_length;) {
+		unsigned next = classify_operands(code, ip, lv.kinds);
+
+		if (lv.kinds[next - 1] == OPERAND_JUMP_TARGET) {
+			is_block_start[code[next - 1].count] = true;
+			is_block_start[next] = true;
+		} else if (code[ip].op == OPCODE_RETURN) {
+			is_block_start[next] = true;
+		}
+
+		ip = next;
+	}
+
+	for (unsigned ip = 0; ip < code_length; ip++) {
+		if (is_block_start[ip] && lv.kinds[ip] == OPERAND_OPCODE) {
+			lv.block_at[ip] = lv.number_of_blocks;
+			lv.block_starts[lv.number_of_blocks] = ip;
+			lv.number_of_blocks++;
+		}
+	}
+	lv.block_starts[lv.number_of_blocks] = code_length;
+	free(is_block_start);
+
+	// Find the locals which need tracking. `stamp[local]` is one more than the last block that wrote to
+	// `local`, which saves having to clear it for each block.
+	unsigned *stamp = xmalloc(number_of_locals * sizeof(unsigned));
+	unsigned number_tracked = 0;
+
+	for (unsigned local = 0; local < number_of_locals; local++) {
+		stamp[local] = 0;
+		lv.tracked_index[local] = NOT_TRACKED;
+	}
+
+	for (unsigned block = 0; block < lv.number_of_blocks; block++) {
+		for (unsigned ip = lv.block_starts[block]; ip < lv.block_starts[block + 1]; ip++) {
+			unsigned local = code[ip].count;
+
+			// Returning reads the return local.
+			if (lv.kinds[ip] == OPERAND_OPCODE && code[ip].op == OPCODE_RETURN)
+				local = CODEBLOCK_RETURN_LOCAL;
+			else if (lv.kinds[ip] != OPERAND_READ_LOCAL && lv.kinds[ip] != OPERAND_WRITE_LOCAL)
+				continue;
+
+			if (lv.kinds[ip] == OPERAND_WRITE_LOCAL)
+				stamp[local] = block + 1;
+			else if (stamp[local] != block + 1 && lv.tracked_index[local] == NOT_TRACKED)
+				lv.tracked_index[local] = number_tracked++;
+		}
+	}
+
+	lv.set_bytes = (number_tracked + 7) / 8 + 1;
+	lv.live_in = xmalloc(lv.number_of_blocks * lv.set_bytes);
+	memset(lv.live_in, 0, lv.number_of_blocks * lv.set_bytes);
+
+	unsigned char *live = xmalloc(lv.set_bytes);
+
+	// Iterate backwards until we reach a fixed point; loops need more than one pass.
+	bool changed = true;
+	while (changed) {
+		changed = false;
 
-	builder.number_of_locals = 1; // As we have an initial `CODEBLOCK_RETURN_LOCAL`.
+		for (unsigned block = lv.number_of_blocks; block-- > 0;) {
+			live_out_of_block(&lv, block, live);
+
+			for (unsigned ip = lv.block_starts[block + 1]; ip-- > lv.block_starts[block];) {
+				if (lv.kinds[ip] == OPERAND_OPCODE && code[ip].op == OPCODE_RETURN) {
+					if (lv.tracked_index[CODEBLOCK_RETURN_LOCAL] != NOT_TRACKED)
+						SET_LIVE(live, lv.tracked_index[CODEBLOCK_RETURN_LOCAL]);
+					continue;
+				}
+
+				if (lv.kinds[ip] != OPERAND_READ_LOCAL && lv.kinds[ip] != OPERAND_WRITE_LOCAL)
+					continue;
+
+				unsigned index = lv.tracked_index[code[ip].count];
+				if (index == NOT_TRACKED)
+					continue;
+
+				if (lv.kinds[ip] == OPERAND_WRITE_LOCAL)
+					CLEAR_LIVE(live, index);
+				else
+					SET_LIVE(live, index);
+			}
+
+			if (memcmp(live, &lv.live_in[block * lv.set_bytes], lv.set_bytes)) {
+				memcpy(&lv.live_in[block * lv.set_bytes], live, lv.set_bytes);
+				changed = true;
+			}
+		}
+	}
+
+	// Now tag each read after which its local is dead, walking each block backwards. Untracked locals
+	// are live iff their `stamp` is the current block's, so they all start off dead in each block.
+	for (unsigned local = 0; local < number_of_locals; local++)
+		stamp[local] = 0;
+
+	for (unsigned block = 0; block < lv.number_of_blocks; block++) {
+		live_out_of_block(&lv, block, live);
+
+		for (unsigned ip = lv.block_starts[block + 1]; ip-- > lv.block_starts[block];) {
+			if (lv.kinds[ip] == OPERAND_OPCODE && code[ip].op == OPCODE_RETURN) {
+				if (lv.tracked_index[CODEBLOCK_RETURN_LOCAL] == NOT_TRACKED)
+					stamp[CODEBLOCK_RETURN_LOCAL] = block + 1;
+				else
+					SET_LIVE(live, lv.tracked_index[CODEBLOCK_RETURN_LOCAL]);
+				continue;
+			}
+
+			if (lv.kinds[ip] != OPERAND_READ_LOCAL && lv.kinds[ip] != OPERAND_WRITE_LOCAL)
+				continue;
+
+			unsigned local = code[ip].count;
+			unsigned index = lv.tracked_index[local];
+			bool is_live = index == NOT_TRACKED ? stamp[local] == block + 1 : IS_LIVE(live, index);
+
+			if (lv.kinds[ip] == OPERAND_WRITE_LOCAL) {
+				if (index == NOT_TRACKED)
+					stamp[local] = 0;
+				else
+					CLEAR_LIVE(live, index);
+				continue;
+			}
+
+			// When an instruction reads the same local more than once, only the last read may move the
+			// value out, which walking backwards handles for us.
+			if (!is_live) {
+				LOG("code[% 3d] = local(%d) (last use)", ip, local);
+				code[ip].count |= CODEBLOCK_MOVE_LOCAL_FLAG;
+
+				if (index == NOT_TRACKED)
+					stamp[local] = block + 1;
+				else
+					SET_LIVE(live, index);
+			}
+		}
+	}
+
+	free(live);
+	free(stamp);
+	free(lv.live_in);
+	free(lv.tracked_index);
+	free(lv.block_at);
+	free(lv.block_starts);
+	free(lv.kinds);
+}
+
+codeblock_builder *begin_function(const ast_declaration *declaration) {
+	assert(declaration->kind == AST_DECLARATION_FUNCTION);
+
+	// declare it beforehand so recursive functions can reference the defn.
+	(void) declare_global_variable(declaration->function.name);
+
+	codeblock_builder *builder = xmalloc(sizeof(codeblock_builder));
+
+	init_index_table(&builder->local_variables);
+	builder->number_of_visible_globals = number_of_global_variables();
+	builder->number_of_locals = 1; // As we have an initial `CODEBLOCK_RETURN_LOCAL`.
 
 	// Arguments are simply the first few local variables
-	for (unsigned i = 0; i < number_of_arguments; i++)
-		(void) declare_local_variable(&builder, strdup(argument_names[i]));
+	for (unsigned i = 0; i < declaration->function.number_of_arguments; i++)
+		(void) declare_local_variable(builder, declaration->function.argument_names[i]);
 
-	builder.constants.length = 0;
-	builder.constants.capacity = 4;
-	builder.constants.consts = xmalloc(builder.constants.capacity * sizeof(value));
+	builder->constants.length = 0;
+	builder->constants.capacity = 4;
+	builder->constants.consts = xmalloc(builder->constants.capacity * sizeof(value));
+	init_index_table(&builder->constants.indices);
+	builder->constants.number_of_duplicates = 0;
+	builder->constants.duplicates_capacity = 0;
+	builder->constants.duplicates = NULL;
 
-	builder.bytecode.length = 0;
-	builder.bytecode.capacity = 8;
-	builder.bytecode.code = xmalloc(builder.bytecode.capacity * sizeof(bytecode));
+	builder->bytecode.length = 0;
+	builder->bytecode.capacity = 8;
+	builder->bytecode.code = xmalloc(builder->bytecode.capacity * sizeof(bytecode));
 
-	builder.whiles.length = 0;
+	builder->whiles = NULL;
 
-	compile_block(&builder, body);
+	return builder;
+}
 
+// This only touches `builder`, so it's safe to call from multiple threads at once.
+static void finish_function_body(codeblock_builder *builder) {
 	// all functions implicitly return `null` at the end.
-	load_constant(&builder, VALUE_NULL, CODEBLOCK_RETURN_LOCAL);
-	set_opcode(&builder, OPCODE_RETURN);
+	load_constant(builder, VALUE_NULL, CODEBLOCK_RETURN_LOCAL);
+	set_opcode(builder, OPCODE_RETURN);
+
+	mark_last_uses(builder);
 
-	for (unsigned i = 0; i < builder.local_variables.length; i++)
-		free(builder.local_variables.entries[i].name);
-	free(builder.local_variables.entries);
+	free_index_table(&builder->local_variables);
+	free_index_table(&builder->constants.indices);
+	free(builder->whiles);
+}
+
+// Builds the codeblock for a finished function, freeing `builder`.
+static codeblock *build_codeblock(codeblock_builder *builder) {
+	for (unsigned i = 0; i < builder->constants.number_of_duplicates; i++)
+		free_value(builder->constants.duplicates[i]);
+	free(builder->constants.duplicates);
 
 	codeblock *block = new_codeblock(
-		builder.number_of_locals,
-		builder.bytecode.length,
-		builder.bytecode.code,
-		builder.constants.length,
-		builder.constants.consts
+		builder->number_of_locals,
+		builder->bytecode.length,
+		builder->bytecode.code,
+		builder->constants.length,
+		builder->constants.consts
 	);
 
-	return new_function(
-		function_name,
-		block,
-		number_of_arguments,
-		argument_names,
-		source_line_number,
-		source_filename
+	free(builder);
+	return block;
+}
+
+// Creates `declaration`'s function and assigns it to its global. `body` may be `NULL` for functions
+// that are compiled lazily.
+static function *install_function(codeblock *body, const ast_declaration *declaration) {
+	function *func = new_function(
+		declaration->function.name,
+		body,
+		declaration->function.number_of_arguments,
+		declaration->function.argument_names,
+		declaration->source.line_number,
+		declaration->source.filename
 	);
+
+	unsigned global = declare_global_variable(declaration->function.name);
+	value existing = fetch_global_variable(global);
+
+	if (existing != VALUE_NULL && !(is_builtin_function(existing) && as_builtin_function(existing)->replaceable))
+		parse_error("function %s redefined", declaration->function.name);
+
+	assign_global_variable(global, new_function_value(func));
+	return func;
 }
 
-static void compile_declaration(ast_declaration *declaration) {
-	switch (declaration->kind) {
-	case AST_DECLARATION_FUNCTION: {
-		// declare it beforehand so recursive functions can reference the defn.
-		unsigned global = declare_global_variable(strdup(declaration->function.name));
+void finish_function(codeblock_builder *builder, const ast_declaration *declaration) {
+	finish_function_body(builder);
+	install_function(build_codeblock(builder), declaration);
+}
 
-		value function = new_function_value(build_function(
-			declaration->function.name,
-			declaration->function.number_of_arguments,
-			declaration->function.argument_names,
-			declaration->function.body,
-			declaration->source.filename,
-			declaration->source.line_number
-		));
+/*
+ * Checking lazy functions.
+ *
+ * Lazy functions aren't compiled until they're called, but a program has to be rejected for the same
+ * errors either way. So when they're declared, their bodies are walked in the same order that
+ * `compile_block` would, reporting the first error it would have. As their ASTs are thrown away
+ * afterwards, this also releases their literals, which `load_constant` would otherwise have taken.
+ */
+typedef struct {
+	index_table local_variables;
+	unsigned number_of_visible_globals;
+	unsigned number_of_whiles;
+	unsigned number_of_breaks[MAX_NUMBER_OF_NESTED_WHILES];
+} lazy_checker;
+
+static void check_lazy_expression(lazy_checker *checker, ast_expression *expression);
+static void check_lazy_block(lazy_checker *checker, ast_block *block);
+
+static bool is_lazy_variable_visible(lazy_checker *checker, const char *name) {
+	return lookup_index(&checker->local_variables, (uintptr_t) name) != VARIABLE_DOESNT_EXIST
+		|| lookup_visible_global_variable(checker->number_of_visible_globals, name) != GLOBAL_DOESNT_EXIST;
+}
 
-		if (fetch_global_variable(global) != VALUE_NULL)
-			parse_error("function %s redefined", declaration->function.name);
+static void declare_lazy_local_variable(lazy_checker *checker, const char *name) {
+	if (lookup_index(&checker->local_variables, (uintptr_t) name) == INDEX_TABLE_MISSING)
+		insert_index(&checker->local_variables, (uintptr_t) name, 0);
+}
 
-		assign_global_variable(global, function);
+static void check_lazy_primary(lazy_checker *checker, ast_primary *primary) {
+	switch (primary->kind) {
+	case AST_PRIMARY_PAREN:
+		check_lazy_expression(checker, primary->paren.expression);
+		break;
+
+	case AST_PRIMARY_INDEX:
+		check_lazy_primary(checker, primary->index.source);
+		check_lazy_expression(checker, primary->index.index);
+		break;
+
+	case AST_PRIMARY_FUNCTION_CALL:
+		check_lazy_primary(checker, primary->function_call.function);
+		for (unsigned i = 0; i < primary->function_call.number_of_arguments; i++)
+			check_lazy_expression(checker, primary->function_call.arguments[i]);
+		break;
+
+	case AST_PRIMARY_UNARY_OPERATOR:
+		check_lazy_primary(checker, primary->unary_operator.primary);
+		break;
+
+	case AST_PRIMARY_ARRAY_LITERAL:
+		for (unsigned i = 0; i < primary->array_literal.length; i++)
+			check_lazy_expression(checker, primary->array_literal.elements[i]);
+		break;
+
+	case AST_PRIMARY_VARIABLE:
+		if (!is_lazy_variable_visible(checker, primary->variable.name))
+			parse_error("undeclared variable '%s'", primary->variable.name);
+		break;
+
+	case AST_PRIMARY_LITERAL:
+		free_value(primary->literal.val);
 		break;
 	}
+}
+
+static void check_lazy_expression(lazy_checker *checker, ast_expression *expression) {
+	switch (expression->kind) {
+	case AST_EXPRESSION_ASSIGN:
+		check_lazy_expression(checker, expression->assign.value);
+
+		if (!is_lazy_variable_visible(checker, expression->assign.name))
+			parse_error("unknown variable '%s'; declare it first.", expression->assign.name);
+		break;
+
+	case AST_EXPRESSION_INDEX_ASSIGN:
+		check_lazy_primary(checker, expression->index_assign.source);
+		check_lazy_expression(checker, expression->index_assign.index);
+		check_lazy_expression(checker, expression->index_assign.value);
+		break;
+
+	case AST_EXPRESSION_SHORT_CIRCUIT_OPERATOR:
+		check_lazy_primary(checker, expression->short_circuit_operator.lhs);
+		check_lazy_expression(checker, expression->short_circuit_operator.rhs);
+		break;
 
-	case AST_DECLARATION_IMPORT: {
-		// read the file contents
-		char *contents = read_file(declaration->import.path);
-		compile(declaration->import.path, contents);
+	case AST_EXPRESSION_BINARY_OPERATOR:
+		check_lazy_primary(checker, expression->binary_operator.lhs);
+		check_lazy_expression(checker, expression->binary_operator.rhs);
+		break;
+
+	case AST_EXPRESSION_PRIMARY:
+		check_lazy_primary(checker, expression->primary);
 		break;
 	}
+}
+
+static void check_lazy_loop(lazy_checker *checker, ast_block *body, const char *kind) {
+	if (checker->number_of_whiles == MAX_NUMBER_OF_NESTED_WHILES)
+		parse_error("too many nested %ss encountered; only %d max allowed", kind, MAX_NUMBER_OF_NESTED_WHILES);
+
+	checker->number_of_breaks[checker->number_of_whiles++] = 0;
+	check_lazy_block(checker, body);
+	checker->number_of_whiles--;
+}
+
+static void check_lazy_statement(lazy_checker *checker, ast_statement *statement) {
+	switch (statement->kind) {
+	case AST_STATEMENT_LOCAL:
+		declare_lazy_local_variable(checker, statement->local.name);
+
+		if (statement->local.initializer != NULL)
+			check_lazy_expression(checker, statement->local.initializer);
+		break;
+
+	case AST_STATEMENT_RETURN:
+		if (statement->return_.expression != NULL)
+			check_lazy_expression(checker, statement->return_.expression);
+		break;
+
+	case AST_STATEMENT_IF:
+		check_lazy_expression(checker, statement->if_.condition);
+		check_lazy_block(checker, statement->if_.if_true);
+
+		if (statement->if_.if_false != NULL)
+			check_lazy_block(checker, statement->if_.if_false);
+		break;
+
+	case AST_STATEMENT_WHILE:
+		check_lazy_expression(checker, statement->while_.condition);
+		check_lazy_loop(checker, statement->while_.body, "while");
+		break;
+
+	case AST_STATEMENT_FOR:
+		check_lazy_statement(checker, statement->for_.initializer);
+		check_lazy_expression(checker, statement->for_.updator);
+		check_lazy_expression(checker, statement->for_.condition);
+		check_lazy_loop(checker, statement->for_.body, "for");
+		break;
+
+	case AST_STATEMENT_BREAK:
+		if (checker->number_of_whiles == 0)
+			parse_error("cannot break when not within a while");
+
+		if (checker->number_of_breaks[checker->number_of_whiles - 1]++ == MAX_NUMBER_OF_BREAKS_PER_WHILE) {
+			parse_error(
+				"too many breaks encountered; only %d max allowed per while",
+				MAX_NUMBER_OF_BREAKS_PER_WHILE
+			);
+		}
+		break;
+
+	case AST_STATEMENT_CONTINUE:
+		if (checker->number_of_whiles == 0)
+			parse_error("cannot continue when not within a while");
+		break;
+
+	case AST_STATEMENT_EXPRESSION:
+		check_lazy_expression(checker, statement->expression);
+		break;
+	}
+}
+
+static void check_lazy_block(lazy_checker *checker, ast_block *block) {
+	for (unsigned i = 0; i < block->number_of_statements; i++)
+		check_lazy_statement(checker, block->statements[i]);
+}
+
+// Lazy functions are parsed and checked when they're declared, so their errors are still reported up
+// front, but then only their starting point in the source code is kept. When they're first called,
+// they're parsed again from there and compiled, seeing only the globals that were visible here.
+static void declare_lazy_function(
+	const ast_declaration *declaration,
+	const char *source,
+	unsigned source_line_number
+) {
+	function *func = install_function(NULL, declaration);
+	func->uncompiled_source = source;
+	func->uncompiled_source_line_number = source_line_number;
+	func->uncompiled_number_of_visible_globals = number_of_global_variables();
+
+	lazy_checker checker;
+	init_index_table(&checker.local_variables);
+	checker.number_of_visible_globals = func->uncompiled_number_of_visible_globals;
+	checker.number_of_whiles = 0;
+
+	for (unsigned i = 0; i < declaration->function.number_of_arguments; i++)
+		declare_lazy_local_variable(&checker, declaration->function.argument_names[i]);
+
+	check_lazy_block(&checker, declaration->function.body);
+	free_index_table(&checker.local_variables);
+}
+
+void compile_lazy_function(function *func) {
+	assert(func->body == NULL && func->uncompiled_source != NULL);
+
+	tokenizer tzr = new_tokenizer(func->source_filename, func->uncompiled_source);
+	tzr.line_number = func->uncompiled_source_line_number;
+	arena ast_arena = new_arena();
+
+	ast_declaration *declaration = next_declaration(&tzr, &ast_arena, false);
+	assert(declaration->kind == AST_DECLARATION_FUNCTION);
+	assert(declaration->function.name == func->function_name);
+
+	codeblock_builder *builder = begin_function(declaration);
+	builder->number_of_visible_globals = func->uncompiled_number_of_visible_globals;
+	compile_block(builder, declaration->function.body);
+	finish_function_body(builder);
+
+	func->body = build_codeblock(builder);
+	func->uncompiled_source = NULL;
+
+	// `func` already has its own copy of the argument names.
+	free(declaration->function.argument_names);
+	free_arena(&ast_arena);
+}
+
+// When compiling on multiple threads, functions are declared as they're parsed, and then their
+// bodies are compiled together once the whole program has been parsed.
+static struct {
+	unsigned length, capacity;
+	struct pending_function {
+		const ast_declaration *declaration;
+		codeblock_builder *builder;
+		char *error; // The error compiling the function's body ran into, if any.
+	} *functions;
+
+	// The arenas holding the functions' ASTs, which must be kept until they're compiled.
+	unsigned number_of_arenas, arenas_capacity;
+	arena *arenas;
+
+	atomic_uint next_function;
+	atomic_bool failed;
+} pending;
+
+// Where `fail_pending_function` returns to on each thread.
+static _Thread_local jmp_buf pending_function_error_handler;
+
+static _Noreturn void fail_pending_function(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	int length = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	char *error = xmalloc(length + 1);
 
+	va_start(args, fmt);
+	vsnprintf(error, length + 1, fmt, args);
+	va_end(args);
+
+	pending_function_being_compiled->error = error;
+	atomic_store(&pending.failed, true);
+	longjmp(pending_function_error_handler, 1);
+}
+
+static void defer_function(const ast_declaration *declaration) {
+	if (pending.length == pending.capacity) {
+		pending.capacity = pending.capacity == 0 ? 64 : pending.capacity * 2;
+		pending.functions = xrealloc(pending.functions, pending.capacity * sizeof(struct pending_function));
+	}
+
+	pending.functions[pending.length].declaration = declaration;
+	pending.functions[pending.length].builder = begin_function(declaration);
+	pending.functions[pending.length].error = NULL;
+	pending.length++;
+}
+
+static void defer_free_arena(arena ast_arena) {
+	if (pending.number_of_arenas == pending.arenas_capacity) {
+		pending.arenas_capacity = pending.arenas_capacity == 0 ? 8 : pending.arenas_capacity * 2;
+		pending.arenas = xrealloc(pending.arenas, pending.arenas_capacity * sizeof(arena));
+	}
+
+	pending.arenas[pending.number_of_arenas++] = ast_arena;
+}
+
+// Compiling a function body only allocates with `xmalloc` and reads the globals table, which nothing
+// writes to until every body's been compiled. Everything else (building the codeblocks, which uses
+// the pools, and assigning the globals) is left for `compile_pending_functions`.
+//
+// Once a body has an error, threads stop starting new ones. Functions are handed out in the order
+// they're declared, so every function before the failed one is still compiled, and the first error
+// in the program can be reported.
+static void *compile_pending_function_bodies(void *unused) {
+	(void) unused;
+
+	while (!atomic_load(&pending.failed)) {
+		unsigned index = atomic_fetch_add(&pending.next_function, 1);
+		if (pending.length <= index)
+			break;
+
+		struct pending_function *function = &pending.functions[index];
+		pending_function_being_compiled = function;
+
+		if (!setjmp(pending_function_error_handler)) {
+			compile_block(function->builder, function->declaration->function.body);
+			finish_function_body(function->builder);
+		}
+
+		pending_function_being_compiled = NULL;
+	}
+
+	return NULL;
+}
+
+static double current_seconds(void);
+
+static void compile_pending_functions(void) {
+	double start = current_seconds();
+	atomic_store(&pending.next_function, 0);
+	atomic_store(&pending.failed, false);
+
+	// The current thread compiles bodies too, so only `threads - 1` more are needed.
+	unsigned number_of_workers = compile_options.threads - 1;
+	if (pending.length < number_of_workers)
+		number_of_workers = pending.length;
+
+	pthread_t workers[number_of_workers + 1];
+	for (unsigned i = 0; i < number_of_workers; i++) {
+		int error = pthread_create(&workers[i], NULL, compile_pending_function_bodies, NULL);
+		if (error)
+			die("unable to start compiler thread: %s", strerror(error));
+	}
+
+	compile_pending_function_bodies(NULL);
+
+	for (unsigned i = 0; i < number_of_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	if (compile_options.report_module_times) {
+		fprintf(stderr, "compiled %u function bodies on %u threads in %.3fms\n",
+			pending.length, number_of_workers + 1, (current_seconds() - start) * 1e3);
+	}
+
+	// Functions are installed in the order they were declared, so errors are reported the same way as
+	// when compiling on one thread: the first function with an error in its body (or that's been
+	// redefined) is the one that's reported.
+	for (unsigned i = 0; i < pending.length; i++) {
+		if (pending.functions[i].error != NULL)
+			die("%s", pending.functions[i].error);
+
+		install_function(build_codeblock(pending.functions[i].builder), pending.functions[i].declaration);
+	}
+
+	for (unsigned i = 0; i < pending.number_of_arenas; i++)
+		free_arena(&pending.arenas[i]);
+
+	free(pending.functions);
+	free(pending.arenas);
+	pending.length = pending.capacity = 0;
+	pending.number_of_arenas = pending.arenas_capacity = 0;
+	pending.functions = NULL;
+	pending.arenas = NULL;
+}
+
+void compile_parsed_functions(void) {
+	if (pending.length != 0)
+		compile_pending_functions();
+}
+
+static void compile_declaration(ast_declaration *declaration) {
+	switch (declaration->kind) {
+	case AST_DECLARATION_FUNCTION: {
+		if (1 < compile_options.threads) {
+			defer_function(declaration);
+			break;
+		}
+
+		codeblock_builder *builder = begin_function(declaration);
+		compile_block(builder, declaration->function.body);
+		finish_function(builder, declaration);
+		break;
+	}
+
+	case AST_DECLARATION_IMPORT:
+		compile_file(declaration->import.path);
+		break;
 
 	case AST_DECLARATION_GLOBAL:
 		declare_global_variable(declaration->global.name);
 		break;
 	}
-
-	free(declaration);
 }
 
-void compile(const char *filename, const char *source_code) {
+void compile(const char *filename, const char *source_code, size_t length) {
+	// How many `compile`s (ie imports) are in progress, so we know when the whole program's parsed.
+	static unsigned depth = 0;
+
+	// Lazy functions aren't compiled until they're called, and streamed functions are compiled as
+	// they're parsed, so neither can be compiled on other threads.
+	if (compile_options.lazy)
+		compile_options.streaming = false;
+	if (compile_options.lazy || compile_options.streaming)
+		compile_options.threads = 1;
+
 	tokenizer tzr = new_tokenizer(filename, source_code);
+	tzr.end = source_code + length;
+	arena ast_arena = new_arena();
+	depth++;
 
 	while (true) {
-		ast_declaration *declaration = next_declaration(&tzr);
+		// Declarations always end with a token that's been consumed, so nothing's been peeked at yet,
+		// and this is exactly where the next declaration starts.
+		assert(tzr.prev.kind == TOKEN_KIND_UNDEFINED);
+		const char *declaration_source = tzr.stream;
+		unsigned declaration_line_number = tzr.line_number;
+
+		ast_declaration *declaration = next_declaration(&tzr, &ast_arena, compile_options.streaming);
 
 		if (declaration == NULL)
 			break;
@@ -680,6 +1440,168 @@ void compile(const char *filename, const char *source_code) {
 		dump_ast_declaration(stdout, declaration);
 #endif
 
-		compile_declaration(declaration);
+		// Streamed functions are compiled as they're parsed, so there's nothing left to do for them.
+		if (declaration->kind != AST_DECLARATION_FUNCTION)
+			compile_declaration(declaration);
+		else if (compile_options.lazy)
+			declare_lazy_function(declaration, declaration_source, declaration_line_number);
+		else if (!compile_options.streaming)
+			compile_declaration(declaration);
+
+		// The declaration's been compiled, so we don't need its AST anymore (unless its function's
+		// body is waiting to be compiled).
+		if (compile_options.threads <= 1)
+			reset_arena(&ast_arena);
 	}
+
+	depth--;
+
+	if (compile_options.threads <= 1) {
+		free_arena(&ast_arena);
+		return;
+	}
+
+	defer_free_arena(ast_arena);
+
+	if (depth == 0)
+		compile_pending_functions();
+}
+
+// Every file that's been (or is being) compiled. Files are identified by their device and inode, so
+// different paths to the same file (eg `lib.friar` and `./lib.friar`, or symlinks) are the same
+// module. There's rarely more than a handful of them, so they're just searched linearly.
+typedef struct module {
+	char *path; // The file's `realpath`, for error messages.
+	dev_t device;
+	ino_t inode;
+	bool compiling;
+
+	// The module that imported this one first. While a module's being compiled, following these gives
+	// the chain of imports that led to it.
+	struct module *importer;
+
+	// How long was spent compiling the modules this one imported, for `report_module_times`.
+	double seconds_in_imports;
+
+	// The source code, which is only kept if `compile_options.lazy` is set (as functions are compiled
+	// from it later).
+	file_contents source;
+	bool has_source;
+} module;
+
+static struct {
+	unsigned length, capacity;
+	module **entries;
+} modules;
+
+static module *current_module;
+
+static module *find_module(dev_t device, ino_t inode) {
+	for (unsigned i = 0; i < modules.length; i++) {
+		if (modules.entries[i]->device == device && modules.entries[i]->inode == inode)
+			return modules.entries[i];
+	}
+
+	return NULL;
+}
+
+static module *new_module(const char *path, const struct stat *info) {
+	if (modules.length == modules.capacity) {
+		modules.capacity = modules.capacity == 0 ? 8 : modules.capacity * 2;
+		modules.entries = xrealloc(modules.entries, modules.capacity * sizeof(module *));
+	}
+
+	module *mod = xmalloc(sizeof(module));
+	// Things like pipes (eg `/dev/stdin`) don't have a real path, so just use the one we were given.
+	mod->path = realpath(path, NULL);
+	if (mod->path == NULL)
+		mod->path = strdup(path);
+
+	mod->device = info->st_dev;
+	mod->inode = info->st_ino;
+	mod->compiling = false;
+	mod->importer = current_module;
+	mod->seconds_in_imports = 0;
+	mod->has_source = false;
+
+	modules.entries[modules.length] = mod;
+	modules.length++;
+	return mod;
+}
+
+// Prints the chain of imports from `to` through to `from`, which `to` must (indirectly) import.
+static void print_import_chain(const module *from, const module *to) {
+	if (from != to)
+		print_import_chain(from->importer, to);
+
+	fprintf(stderr, "%s -> ", from->path);
+}
+
+static double current_seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void compile_file(const char *path) {
+	struct stat info;
+	if (stat(path, &info)) {
+		int error = errno;
+		compile_parsed_functions();
+		die("unable to read file '%s': %s", path, strerror(error));
+	}
+
+	module *mod = find_module(info.st_dev, info.st_ino);
+
+	if (mod != NULL) {
+		if (!mod->compiling)
+			return; // It's already been compiled, so there's nothing to do.
+
+		compile_parsed_functions();
+		fputs("import cycle: ", stderr);
+		print_import_chain(current_module, mod);
+		die("%s", mod->path);
+	}
+
+	mod = new_module(path, &info);
+	mod->compiling = true;
+	current_module = mod;
+
+	double start = current_seconds();
+
+	// Unless functions are compiled lazily, nothing keeps references into the source code once it's
+	// compiled, so it can be freed.
+	file_contents contents = read_file(path);
+	compile(path, contents.ptr, contents.length);
+
+	if (compile_options.lazy) {
+		mod->source = contents;
+		mod->has_source = true;
+	} else {
+		free_file_contents(contents);
+	}
+
+	double seconds = current_seconds() - start;
+
+	mod->compiling = false;
+	current_module = mod->importer;
+
+	if (current_module != NULL)
+		current_module->seconds_in_imports += seconds;
+
+	if (compile_options.report_module_times) {
+		fprintf(stderr, "compiled %s in %.3fms (%.3fms excluding imports)\n",
+			mod->path, seconds * 1e3, (seconds - mod->seconds_in_imports) * 1e3);
+	}
+}
+
+void free_modules(void) {
+	for (unsigned i = 0; i < modules.length; i++) {
+		free(modules.entries[i]->path);
+		if (modules.entries[i]->has_source)
+			free_file_contents(modules.entries[i]->source);
+		free(modules.entries[i]);
+	}
+
+	free(modules.entries);
 }
@@ -1,3 +1,72 @@
 #pragma once
+#include <stdbool.h>
+#include "ast.h"
+#include "function.h"
 
-void compile(const char *filename, const char *source_code);
+extern struct compile_options {
+	// Generate each function's code while its body is being parsed, instead of building up its whole
+	// AST first. This bounds the memory used by huge functions (such as generated data tables) to their
+	// bytecode, plus whatever statement is currently being compiled.
+	bool streaming;
+
+	// Print how long each file took to compile to stderr.
+	bool report_module_times;
+
+	// If more than one, function bodies are compiled on this many threads. Every file is parsed and
+	// all of its declarations are registered first, and then the bodies are compiled all at once.
+	// Bodies can still only refer to globals declared before them, and errors are reported just like
+	// they are on one thread. This is ignored when `streaming` is set.
+	unsigned threads;
+
+	// Don't compile functions until they're first called. They're still parsed and checked up front,
+	// so the same programs are rejected with the same errors, and bodies can still only refer to
+	// globals declared before them. This overrides `streaming` and `threads`.
+	bool lazy;
+} compile_options;
+
+// Compiles `length` bytes of `source_code`, which must be followed by a NUL byte.
+void compile(const char *filename, const char *source_code, size_t length);
+
+// Reads and compiles the file at `path`, unless it's already been compiled. Files are compiled at
+// most once no matter how many paths they're imported by, and importing a file that's still being
+// compiled (ie an import cycle) is an error.
+void compile_file(const char *path);
+
+// Frees the list of compiled files.
+void free_modules(void);
+
+// When compiling on multiple threads, compiles the function bodies that have been parsed so far,
+// reporting the first error in them. Errors found while parsing call this before they're reported,
+// so a body with an error that comes earlier in the program is reported first, like on one thread.
+void compile_parsed_functions(void);
+
+// Compiles a function that was declared while `compile_options.lazy` was set.
+void compile_lazy_function(function *func);
+
+// The rest of these let the parser generate code directly when `compile_options.streaming` is set;
+// the non-streaming compiler uses them too, so both produce the exact same code.
+typedef struct codeblock_builder codeblock_builder;
+
+// Declares `declaration`'s function and returns a builder for its body.
+codeblock_builder *begin_function(const ast_declaration *declaration);
+
+// Finishes the function's code, and assigns it to its global. This frees `builder`.
+void finish_function(codeblock_builder *builder, const ast_declaration *declaration);
+
+void compile_statement(codeblock_builder *builder, ast_statement *statement);
+
+// Compiles an `if`'s condition, returning the jump to fill in when the body's done. If there's an
+// `else`, pass that jump to `compile_else` (before the `else`'s body), and use its return value.
+unsigned compile_if_condition(codeblock_builder *builder, ast_expression *condition);
+unsigned compile_else(codeblock_builder *builder, unsigned if_false_jump);
+void compile_end_if(codeblock_builder *builder, unsigned pending_jump);
+
+// Compiles the start of a loop, returning the jump to pass to `compile_end_loop` after its body.
+unsigned compile_while_condition(codeblock_builder *builder, ast_expression *condition);
+unsigned compile_for_header(
+	codeblock_builder *builder,
+	ast_statement *initializer,
+	ast_expression *condition,
+	ast_expression *updator
+);
+void compile_end_loop(codeblock_builder *builder, unsigned jump_to_end);
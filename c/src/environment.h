@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #define die_with_stacktrace(...) (\
+	fflush(stdout), \
 	fprintf(stderr, __VA_ARGS__), \
 	fputs("\nstacktrace:\n", stderr), \
 	dump_stacktrace(stderr), \
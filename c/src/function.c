@@ -1,19 +1,21 @@
 #include "function.h"
 #include "shared.h"
+#include "pool.h"
+#include "compile.h"
 #include <assert.h>
 #include <string.h>
 
 function *new_function(
-	char *function_name,
+	const char *function_name,
 	codeblock *body,
 	unsigned number_of_arguments,
-	char **argument_names,
+	const char **argument_names,
 	unsigned source_line_number,
 	const char *source_filename
 ) {
 	assert(strlen(function_name) != 0);
 
-	function *func = xmalloc(sizeof(function));
+	function *func = pool_alloc(sizeof(function));
 
 	func->function_name = function_name;
 	func->body = body;
@@ -22,6 +24,9 @@ function *new_function(
 	func->argument_names = argument_names;
 	func->source_line_number = source_line_number;
 	func->source_filename = source_filename;
+	func->uncompiled_source = NULL;
+	func->uncompiled_source_line_number = 0;
+	func->uncompiled_number_of_visible_globals = 0;
 
 	return func;
 }
@@ -29,17 +34,14 @@ function *new_function(
 void deallocate_function(function *func) {
 	assert(func->refcount == 0);
 
-	free(func->function_name);
-	free_codeblock(func->body);
+	if (func->body != NULL)
+		free_codeblock(func->body);
+	free(func->argument_names); // The names themselves are interned.
 
-	for (unsigned i = 0; i < func->number_of_arguments; i++)
-		free(func->argument_names[i]);
-	free(func->argument_names);
-
-	free(func);
+	pool_free(func, sizeof(function));
 }
 
-value call_function(const function *func, unsigned number_of_arguments, const value *arguments) {
+value call_function(function *func, unsigned number_of_arguments, const value *arguments) {
 	if (func->number_of_arguments != number_of_arguments) {
 		die_with_stacktrace(
 			"argument mismatch for %s: expected %d, got %d",
@@ -56,6 +58,10 @@ value call_function(const function *func, unsigned number_of_arguments, const va
 	};
 
 	enter_stackframe(&location);
+
+	if (func->body == NULL)
+		compile_lazy_function(func);
+
 	value ret = run_codeblock(func->body, number_of_arguments, arguments);
 	leave_stackframe();
 
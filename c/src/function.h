@@ -9,21 +9,28 @@
 typedef struct {
 	VALUE_ALIGNMENT codeblock *body;
 
-	char *function_name;
+	const char *function_name;
 	unsigned refcount;
 
 	unsigned number_of_arguments;
-	char **argument_names;
+	const char **argument_names;
 
 	unsigned source_line_number;
 	const char *source_filename;
+
+	// Lazily compiled functions (see `compile_options.lazy`) don't have a `body` until they're first
+	// called. Until then, this is where their declaration starts in their file's source code, and how
+	// many globals had been declared by then (which are the only ones their bodies can see).
+	const char *uncompiled_source;
+	unsigned uncompiled_source_line_number;
+	unsigned uncompiled_number_of_visible_globals;
 } function;
 
 function *new_function(
-	char *function_name,
+	const char *function_name,
 	codeblock *body,
 	unsigned number_of_arguments,
-	char **argument_names,
+	const char **argument_names,
 	unsigned source_line_number,
 	const char *source_filename
 );
@@ -43,5 +50,5 @@ static inline function *clone_function(function *func) {
 	return func;
 }
 
-value call_function(const function *func, unsigned number_of_arguments, const value *arguments);
+value call_function(function *func, unsigned number_of_arguments, const value *arguments);
 void dump_function(FILE *out, const function *func);
@@ -2,25 +2,29 @@
 #include "shared.h"
 #include "value.h"
 #include "builtin_function.h"
+#include "index_table.h"
+#include <stdint.h>
 
 typedef struct {
-	char *name;
+	const char *name;
 	value val;
 } global_variable_entry;
 
 struct {
 	unsigned length, capacity;
 	global_variable_entry *entries;
+	index_table indices; // Maps the (interned) names of globals to their indices in `entries`.
 } globals;
 
 void init_global_variables(void) {
 	globals.length = 0;
 	globals.capacity = 8;
 	globals.entries = xmalloc(globals.capacity * sizeof(global_variable_entry));
+	init_index_table(&globals.indices);
 
 	for (unsigned i = 0; i < NUMBER_OF_BUILTIN_FUNCTIONS; i++) {
 		assign_global_variable(
-			declare_global_variable(strdup(builtin_functions[i].name)),
+			declare_global_variable(intern_identifier(builtin_functions[i].name, strlen(builtin_functions[i].name))),
 			new_builtin_function_value(&builtin_functions[i])
 		);
 	}
@@ -28,23 +32,23 @@ void init_global_variables(void) {
 
 void free_global_variables(void) {
 	for (unsigned i = 0; i < globals.length; i++) {
-		free(globals.entries[i].name);
 		free_value(globals.entries[i].val);
 	}
 
 	free(globals.entries);
+	free_index_table(&globals.indices);
 }
 
-int lookup_global_variable(const char *name) {
-	for (unsigned i = 0; i < globals.length; i++) {
-		if (!strcmp(name, globals.entries[i].name))
-			return i;
-	}
+unsigned number_of_global_variables(void) {
+	return globals.length;
+}
 
-	return GLOBAL_DOESNT_EXIST;
+int lookup_global_variable(const char *name) {
+	int index = lookup_index(&globals.indices, (uintptr_t) name);
+	return index == INDEX_TABLE_MISSING ? GLOBAL_DOESNT_EXIST : index;
 }
 
-unsigned declare_global_variable(char *name) {
+unsigned declare_global_variable(const char *name) {
 	int previous_index = lookup_global_variable(name);
 	if (previous_index != GLOBAL_DOESNT_EXIST)
 		return previous_index;
@@ -58,6 +62,7 @@ unsigned declare_global_variable(char *name) {
 	globals.entries[index].name = name;
 	globals.entries[index].val = VALUE_NULL;
 	globals.length++;
+	insert_index(&globals.indices, (uintptr_t) name, index);
 	return index;
 }
 
@@ -73,3 +78,11 @@ value fetch_global_variable(unsigned index) {
 
 	return clone_value(globals.entries[index].val);
 }
+
+value take_global_variable(unsigned index) {
+	assert(index < globals.length);
+
+	value val = globals.entries[index].val;
+	globals.entries[index].val = VALUE_NULL;
+	return val;
+}
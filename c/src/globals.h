@@ -5,10 +5,19 @@ void init_global_variables(void);
 void free_global_variables(void);
 
 // the index of the global variable, creating it with a default of VALUE_NULL if it doesnt exist.
-unsigned declare_global_variable(char *name);
+// `name` must be interned (see `intern_identifier`), as globals are compared by pointer.
+unsigned declare_global_variable(const char *name);
+
+// How many globals have been declared. Globals are numbered in the order they're declared, so a
+// global was declared before another one exactly when its index is smaller.
+unsigned number_of_global_variables(void);
 
 #define GLOBAL_DOESNT_EXIST (-1)
 
+// Like `declare_global_variable`, `name` must be interned.
 int lookup_global_variable(const char *name);
 void assign_global_variable(unsigned index, value val);
 value fetch_global_variable(unsigned index);
+
+// Like `fetch_global_variable`, except the global's reference is moved out and it's left as null.
+value take_global_variable(unsigned index);
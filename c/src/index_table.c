@@ -0,0 +1,74 @@
+#include "index_table.h"
+#include "shared.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#ifndef INDEX_TABLE_INITIAL_CAPACITY
+# define INDEX_TABLE_INITIAL_CAPACITY 16
+#endif
+
+// Keys are usually pointers or tagged values, whose low bits are mostly zeros, so they need to be
+// mixed before they can be masked. (This is Fibonacci hashing: the high bits of the product are the
+// well-mixed ones.)
+static unsigned hash_key(uint64_t key) {
+	return (key * 0x9E3779B97F4A7C15) >> 32;
+}
+
+void init_index_table(index_table *table) {
+	table->length = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+}
+
+void free_index_table(index_table *table) {
+	free(table->entries);
+}
+
+static struct index_table_entry *find_entry(const index_table *table, uint64_t key) {
+	unsigned mask = table->capacity - 1;
+
+	for (unsigned i = hash_key(key) & mask; ; i = (i + 1) & mask) {
+		struct index_table_entry *entry = &table->entries[i];
+
+		if (entry->index_plus_one == 0 || entry->key == key)
+			return entry;
+	}
+}
+
+int lookup_index(const index_table *table, uint64_t key) {
+	if (table->length == 0)
+		return INDEX_TABLE_MISSING;
+
+	struct index_table_entry *entry = find_entry(table, key);
+	return entry->index_plus_one - 1; // If it's empty, this'll be `INDEX_TABLE_MISSING`.
+}
+
+static void grow_index_table(index_table *table) {
+	unsigned old_capacity = table->capacity;
+	struct index_table_entry *old_entries = table->entries;
+
+	table->capacity = old_capacity == 0 ? INDEX_TABLE_INITIAL_CAPACITY : old_capacity * 2;
+	table->entries = xmalloc(table->capacity * sizeof(struct index_table_entry));
+
+	for (unsigned i = 0; i < table->capacity; i++)
+		table->entries[i].index_plus_one = 0;
+
+	for (unsigned i = 0; i < old_capacity; i++) {
+		if (old_entries[i].index_plus_one != 0)
+			*find_entry(table, old_entries[i].key) = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+void insert_index(index_table *table, uint64_t key, unsigned index) {
+	if (table->capacity < 2 * (table->length + 1))
+		grow_index_table(table);
+
+	struct index_table_entry *entry = find_entry(table, key);
+	assert(entry->index_plus_one == 0);
+
+	entry->key = key;
+	entry->index_plus_one = index + 1;
+	table->length++;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+// A map from 64-bit keys to indices, used to find things like local variables, global variables,
+// and constants by their (interned) names or values without scanning a whole list. As identifiers
+// and constants are interned, their pointers and values can be used directly as keys.
+//
+// It uses open addressing with linear probing, and its capacity is always a power of two that's at
+// least twice its length.
+typedef struct {
+	unsigned length, capacity;
+	struct index_table_entry {
+		uint64_t key;
+		unsigned index_plus_one; // `0` means the slot is empty, so keys can be any value.
+	} *entries;
+} index_table;
+
+#define INDEX_TABLE_MISSING (-1)
+
+void init_index_table(index_table *table);
+void free_index_table(index_table *table);
+
+// Returns the index associated with `key`, or `INDEX_TABLE_MISSING` if there's none.
+int lookup_index(const index_table *table, uint64_t key);
+
+// Associates `index` with `key`, which must not already be in `table`.
+void insert_index(index_table *table, uint64_t key, unsigned index);
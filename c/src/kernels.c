@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <stdbool.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(KERNELS_NO_TARGET_CLONES)
+# define KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+# define KERNEL
+#endif
+
+// Arithmetic is done with unsigned numbers, which wrap around instead of overflowing, and then the
+// top three bits are discarded (sign-extending the rest), like `new_number_value` does.
+static inline number wrap_number(unsigned long long num) {
+	return (number) (num << 3) >> 3;
+}
+
+KERNEL number sum_numbers(const number *nums, unsigned length) {
+	unsigned long long sum = 0;
+
+	for (unsigned i = 0; i < length; i++)
+		sum += nums[i];
+
+	return wrap_number(sum);
+}
+
+KERNEL number min_numbers(const number *nums, unsigned length) {
+	assert(length != 0);
+	number min = nums[0];
+
+	for (unsigned i = 1; i < length; i++)
+		min = nums[i] < min ? nums[i] : min;
+
+	return min;
+}
+
+KERNEL number max_numbers(const number *nums, unsigned length) {
+	assert(length != 0);
+	number max = nums[0];
+
+	for (unsigned i = 1; i < length; i++)
+		max = nums[i] > max ? nums[i] : max;
+
+	return max;
+}
+
+KERNEL unsigned index_of_number(const number *nums, unsigned length, number target) {
+	unsigned i = 0;
+
+	// Exiting as soon as `target` is found stops the loop from being vectorized, so instead check a
+	// block at a time, and only search the block element-by-element once it's found.
+	for (; i + KERNEL_BLOCK_SIZE <= length; i += KERNEL_BLOCK_SIZE) {
+		bool found = false;
+
+		for (unsigned j = 0; j < KERNEL_BLOCK_SIZE; j++)
+			found |= nums[i + j] == target;
+
+		if (found)
+			break;
+	}
+
+	for (; i < length; i++) {
+		if (nums[i] == target)
+			return i;
+	}
+
+	return length;
+}
+
+KERNEL unsigned count_number(const number *nums, unsigned length, number target) {
+	// The count is the same width as the numbers, so the comparisons don't need to be narrowed.
+	unsigned long long count = 0;
+
+	for (unsigned i = 0; i < length; i++)
+		count += nums[i] == target;
+
+	return count;
+}
+
+KERNEL void add_numbers(number *dst, const number *lhs, const number *rhs, unsigned length) {
+	for (unsigned i = 0; i < length; i++)
+		dst[i] = wrap_number((unsigned long long) lhs[i] + (unsigned long long) rhs[i]);
+}
+
+KERNEL void multiply_numbers(number *dst, const number *lhs, const number *rhs, unsigned length) {
+	for (unsigned i = 0; i < length; i++)
+		dst[i] = wrap_number((unsigned long long) lhs[i] * (unsigned long long) rhs[i]);
+}
+
+KERNEL void fill_numbers(number *dst, unsigned length, number num) {
+	for (unsigned i = 0; i < length; i++)
+		dst[i] = num;
+}
+
+KERNEL void range_numbers(number *dst, unsigned length, number start) {
+	for (unsigned i = 0; i < length; i++)
+		dst[i] = wrap_number((unsigned long long) start + i);
+}
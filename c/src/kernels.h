@@ -0,0 +1,35 @@
+#pragma once
+#include "number.h"
+
+// Loops over arrays of unboxed numbers (see `ARRAY_STRATEGY_NUMBERS`), for the numeric builtins.
+//
+// They're written so that the compiler can vectorize them, and on x86-64 each one is compiled twice:
+// once for AVX2, and once for the baseline (which only has SSE2). Which one's used is picked when
+// the program starts, based on the CPU. On other architectures, they're just compiled normally.
+// Define `KERNELS_NO_TARGET_CLONES` to always use the baseline (eg for libcs without `ifunc`s).
+//
+// Friar numbers only have 61 bits (see `value.h`), so results are wrapped to fit, just as they'd be
+// when boxed, and never overflow.
+
+#ifndef KERNEL_BLOCK_SIZE
+# define KERNEL_BLOCK_SIZE 16
+#endif
+
+number sum_numbers(const number *nums, unsigned length);
+
+// These require `length` to be nonzero.
+number min_numbers(const number *nums, unsigned length);
+number max_numbers(const number *nums, unsigned length);
+
+// Returns the index of the first `target` in `nums`, or `length` if it's not there.
+unsigned index_of_number(const number *nums, unsigned length, number target);
+unsigned count_number(const number *nums, unsigned length, number target);
+
+// `dst` may be the same as `lhs` or `rhs`.
+void add_numbers(number *dst, const number *lhs, const number *rhs, unsigned length);
+void multiply_numbers(number *dst, const number *lhs, const number *rhs, unsigned length);
+
+void fill_numbers(number *dst, unsigned length, number num);
+
+// Sets `dst` to `start`, `start + 1`, ..., `start + length - 1`.
+void range_numbers(number *dst, unsigned length, number start);
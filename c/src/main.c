@@ -3,9 +3,11 @@
 #include "codeblock.h"
 #include "environment.h"
 #include "globals.h"
+#include "pool.h"
+#include <string.h>
 
 static void usage(const char *program_name) {
-	die("usage: %s (-e 'expression' | -f filename)", program_name);
+	die("usage: %s [-s] [-t] [-l] [-j threads] (-e 'expression' | -f filename)", program_name);
 }
 
 int main(int argc, char **argv) {
@@ -13,16 +15,42 @@ int main(int argc, char **argv) {
 	init_global_variables();
 	init_builtin_functions();
 
+	const char *program_name = argv[0];
+
+	// `-s` compiles functions as they're parsed, `-t` reports how long each file took to compile,
+	// `-j threads` compiles function bodies on multiple threads, and `-l` compiles functions when
+	// they're first called (see `compile_options`).
+	while (argc > 3) {
+		if (!strcmp(argv[1], "-s")) {
+			compile_options.streaming = true;
+		} else if (!strcmp(argv[1], "-t")) {
+			compile_options.report_module_times = true;
+		} else if (!strcmp(argv[1], "-l")) {
+			compile_options.lazy = true;
+		} else if (!strcmp(argv[1], "-j") && argc > 4) {
+			compile_options.threads = strtoul(argv[2], NULL, 10);
+			if (compile_options.threads == 0)
+				usage(program_name);
+			argc--;
+			argv++;
+		} else {
+			usage(program_name);
+		}
+
+		argc--;
+		argv++;
+	}
+
 	if (argc != 3 || argv[1][0] != '-' || argv[1][1] == '\0' || argv[1][2] != '\0')
-		usage(argv[0]);
+		usage(program_name);
 
 	switch (argv[1][1]) {
-	case 'e': compile("-e", argv[2]); break;
-	case 'f': compile(argv[2], read_file(argv[2])); break;
-	default: usage(argv[0]);
+	case 'e': compile("-e", argv[2], strlen(argv[2])); break;
+	case 'f': compile_file(argv[2]); break;
+	default: usage(program_name);
 	}
 
-	int main_index = lookup_global_variable("main");
+	int main_index = lookup_global_variable(intern_identifier("main", 4));
 	if (main_index == GLOBAL_DOESNT_EXIST)
 		die("you must define a `main` function");
 
@@ -30,11 +58,17 @@ int main(int argc, char **argv) {
 
 	free_environment();
 	free_global_variables();
+	free_modules();
 
 	// If the return value of `main` is an integer, that's the return status.
-	if (is_number(ret))
-		return as_number(ret);
-
+	int status = is_number(ret) ? as_number(ret) : 0;
 	free_value(ret);
-	return 0;
+	free_interned_strings();
+
+#ifdef ENABLE_POOL_STATS
+	dump_pool_stats(stderr);
+#endif
+	free_pools();
+
+	return status;
 }
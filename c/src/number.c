@@ -11,12 +11,12 @@ string *number_to_string(number num) {
 	// We use `snprintf` just in case `long long`s aren't 64 bits for some reason
 	snprintf(buf, sizeof(buf), "%lld", num);
 
-	return new_string(strdup(buf), strlen(buf));
+	return new_string(buf, strlen(buf));
 }
 
 // We can't use `strtoll` as strings aren't null terminated.
 number string_to_number(const string *str) {
-	const char *ptr = str->ptr;
+	const char *ptr = string_ptr(str);
 	unsigned index = 0;
 
 	// Remove leading whitespace.
@@ -0,0 +1,132 @@
+#include "pool.h"
+#include "shared.h"
+#include <assert.h>
+#include <string.h>
+
+#define NUMBER_OF_SIZE_CLASSES (POOL_MAX_SIZE / POOL_GRANULARITY)
+
+// Free blocks are linked together through their first word.
+typedef struct free_block free_block;
+struct free_block {
+	free_block *next;
+};
+
+// Slabs are linked together so they can be released by `free_pools`.
+typedef struct slab slab;
+struct slab {
+	slab *next;
+	_Alignas(POOL_GRANULARITY) char memory[];
+};
+
+static struct {
+	free_block *free_lists[NUMBER_OF_SIZE_CLASSES];
+	slab *slabs;
+
+	// The unused part of the most recent slab.
+	char *bump, *bump_end;
+} pools;
+
+#ifdef ENABLE_POOL_STATS
+pool_stats_t pool_stats;
+
+void dump_pool_stats(FILE *out) {
+	fprintf(out, "mallocs: %lu, reallocs: %lu\n", pool_stats.mallocs, pool_stats.reallocs);
+	fprintf(out, "pool allocations: %lu (%lu reused), pool frees: %lu, slabs: %lu\n",
+		pool_stats.pool_allocs, pool_stats.pool_reuses, pool_stats.pool_frees, pool_stats.slabs);
+}
+#endif
+
+static unsigned size_class(size_t size) {
+	return (size - 1) / POOL_GRANULARITY;
+}
+
+static void *carve_from_slab(size_t class_size) {
+	if ((size_t) (pools.bump_end - pools.bump) < class_size) {
+		// Whatever was left over in the old slab is too small to bother with, so it's just dropped.
+		slab *new_slab = xmalloc(sizeof(slab) + POOL_SLAB_SIZE);
+		new_slab->next = pools.slabs;
+		pools.slabs = new_slab;
+
+		pools.bump = new_slab->memory;
+		pools.bump_end = new_slab->memory + POOL_SLAB_SIZE;
+		POOL_STAT(slabs);
+	}
+
+	void *ptr = pools.bump;
+	pools.bump += class_size;
+	return ptr;
+}
+
+void *pool_alloc(size_t size) {
+#ifndef POOL_DISABLED
+	if (size == 0)
+		return NULL;
+
+	if (size <= POOL_MAX_SIZE) {
+		unsigned class = size_class(size);
+		free_block *block = pools.free_lists[class];
+		POOL_STAT(pool_allocs);
+
+		if (block == NULL)
+			return carve_from_slab((class + 1) * POOL_GRANULARITY);
+
+		POOL_STAT(pool_reuses);
+		pools.free_lists[class] = block->next;
+		return block;
+	}
+#endif
+
+	return xmalloc(size);
+}
+
+void pool_free(void *ptr, size_t size) {
+	if (ptr == NULL)
+		return;
+
+#ifndef POOL_DISABLED
+	if (size <= POOL_MAX_SIZE) {
+		assert(size != 0);
+
+		unsigned class = size_class(size);
+		free_block *block = ptr;
+		POOL_STAT(pool_frees);
+
+		block->next = pools.free_lists[class];
+		pools.free_lists[class] = block;
+		return;
+	}
+#endif
+
+	(void) size;
+	free(ptr);
+}
+
+void *pool_realloc(void *ptr, size_t old_size, size_t new_size) {
+#ifndef POOL_DISABLED
+	if (old_size <= POOL_MAX_SIZE || new_size <= POOL_MAX_SIZE) {
+		// Blocks in the same size class already have room for the new size.
+		if (ptr != NULL && new_size != 0 && size_class(old_size) == size_class(new_size))
+			return ptr;
+
+		void *new_ptr = pool_alloc(new_size);
+		if (ptr != NULL && new_ptr != NULL)
+			memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+		pool_free(ptr, old_size);
+
+		return new_ptr;
+	}
+#endif
+
+	(void) old_size;
+	return xrealloc(ptr, new_size);
+}
+
+void free_pools(void) {
+	while (pools.slabs != NULL) {
+		slab *next = pools.slabs->next;
+		free(pools.slabs);
+		pools.slabs = next;
+	}
+
+	memset(&pools, 0, sizeof(pools));
+}
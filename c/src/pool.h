@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+// Small allocations (such as array, string, and function headers, and short element and character
+// buffers) are very common and short-lived, so instead of going through `malloc` each time, they're
+// carved out of large slabs and recycled through per-size-class free lists.
+//
+// Each size class is a multiple of `POOL_GRANULARITY` bytes, up to `POOL_MAX_SIZE`; anything larger
+// is passed to `xmalloc`. As the pools don't record how large each allocation is, the same size that
+// it was allocated with must be passed when freeing or reallocating it.
+//
+// Define `POOL_DISABLED` to pass everything to `xmalloc` (eg when debugging memory errors, as the
+// sanitizers can't see inside of slabs), and `ENABLE_POOL_STATS` to keep track of how many
+// allocations the pools are handling.
+
+#ifndef POOL_GRANULARITY
+# define POOL_GRANULARITY 16
+#endif
+
+#ifndef POOL_MAX_SIZE
+# define POOL_MAX_SIZE 256
+#endif
+
+#ifndef POOL_SLAB_SIZE
+# define POOL_SLAB_SIZE (64 * 1024)
+#endif
+
+void *pool_alloc(size_t size);
+void pool_free(void *ptr, size_t size);
+void *pool_realloc(void *ptr, size_t old_size, size_t new_size);
+
+// Releases all the slabs. Nothing allocated from the pools may be used afterwards.
+void free_pools(void);
+
+#ifdef ENABLE_POOL_STATS
+typedef struct {
+	unsigned long mallocs, reallocs; // Calls to `xmalloc` and `xrealloc` (including ones by the pools).
+	unsigned long pool_allocs, pool_reuses, pool_frees, slabs;
+} pool_stats_t;
+
+extern pool_stats_t pool_stats;
+
+# define POOL_STAT(field) (pool_stats.field++)
+void dump_pool_stats(FILE *out);
+#else
+# define POOL_STAT(field) ((void) 0)
+#endif
@@ -1,8 +1,14 @@
 #include "shared.h"
+#include "pool.h"
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void *xmalloc(size_t size) {
+	POOL_STAT(mallocs);
 	void *ptr = malloc(size);
 
 	// If a zero size is given, `malloc` is allowed to return `NULL`.
@@ -15,6 +21,7 @@ void *xmalloc(size_t size) {
 }
 
 void *xrealloc(void *ptr, size_t size) {
+	POOL_STAT(reallocs);
 	ptr = realloc(ptr, size);
 
 	// If a zero size is given, `realloc` is allowed to return `NULL`.
@@ -26,37 +33,76 @@ void *xrealloc(void *ptr, size_t size) {
 	return ptr;
 }
 
-char *read_file(const char *filename) {
-	FILE *file = fopen(filename, "r");
-
-	if (file == NULL)
-		die("unable to read file '%s': %s", filename, strerror(errno));
-
+// Reads everything from `fd` into a buffer, for files that can't be mapped (such as pipes). If it's a
+// regular file, `size_hint` is its size.
+static file_contents read_file_into_buffer(const char *filename, int fd, size_t size_hint) {
 	size_t length = 0;
-	size_t capacity = 2048;
+	size_t capacity = size_hint + 1 < 2048 ? 2048 : size_hint + 1;
 	char *contents = xmalloc(capacity);
 
-	while (!feof(file)) {
-		size_t amntread = fread(&contents[length], 1, capacity - length, file);
+	while (true) {
+		ssize_t amntread = read(fd, &contents[length], capacity - length - 1);
 
-		if (amntread == 0) {
-			if (!feof(file))
-				die("unable to read file '%s': %s'", filename, strerror(errno));
-			break;
+		if (amntread < 0) {
+			if (errno == EINTR)
+				continue;
+
+			die("unable to read file '%s': %s", filename, strerror(errno));
 		}
 
+		if (amntread == 0)
+			break;
+
 		length += amntread;
 
-		if (length == capacity) {
+		if (length + 1 == capacity) {
 			capacity *= 2;
 			contents = xrealloc(contents, capacity);
 		}
 	}
 
-	if (fclose(file) == EOF)
+	contents[length] = '\0';
+	return (file_contents) { .ptr = contents, .length = length, .mapped = false };
+}
+
+file_contents read_file(const char *filename) {
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		die("unable to read file '%s': %s", filename, strerror(errno));
+
+	struct stat info;
+	if (fstat(fd, &info))
+		die("unable to read file '%s': %s", filename, strerror(errno));
+
+	file_contents contents;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	// The kernel fills the rest of a mapping's last page with zeros, so as long as the file doesn't end
+	// exactly on a page boundary, that gives us our NUL terminator for free. (Mapping an extra page
+	// past the end of the file to hold it would fault when accessed.)
+	if (S_ISREG(info.st_mode) && info.st_size != 0 && info.st_size % page_size != 0) {
+		void *ptr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (ptr != MAP_FAILED) {
+			(void) madvise(ptr, info.st_size, MADV_SEQUENTIAL);
+			contents = (file_contents) { .ptr = ptr, .length = info.st_size, .mapped = true };
+			goto done;
+		}
+	}
+
+	contents = read_file_into_buffer(filename, fd, S_ISREG(info.st_mode) ? info.st_size : 0);
+
+done:
+	if (close(fd))
 		perror("couldn't close input file");
 
-	contents = xrealloc(contents, length + 1);
-	contents[length] = '\0';
 	return contents;
 }
+
+void free_file_contents(file_contents contents) {
+	if (contents.mapped)
+		munmap((void *) contents.ptr, contents.length);
+	else
+		free((char *) contents.ptr);
+}
@@ -1,15 +1,27 @@
 #pragma once
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "environment.h"
 
-#define die(...) (fprintf(stderr, __VA_ARGS__), fputs("\n", stderr), exit(1))
+// Output is buffered, so it's flushed before the error message to keep them in order.
+#define die(...) (fflush(stdout), fprintf(stderr, __VA_ARGS__), fputs("\n", stderr), exit(1))
 #define bug(...) (fprintf(stderr, "%s:%d [bug] ", __FILE__, __LINE__), die(__VA_ARGS__))
 
 void *xmalloc(size_t size);
 void *xrealloc(void *ptr, size_t size);
-char *read_file(const char *filename);
+
+// The contents of a file, which are always followed by a NUL byte (which isn't included in `length`).
+// Regular files are mapped into memory where possible, instead of being copied into a buffer.
+typedef struct {
+	const char *ptr;
+	size_t length;
+	bool mapped;
+} file_contents;
+
+file_contents read_file(const char *filename);
+void free_file_contents(file_contents contents);
 
 #ifdef ENABLE_LOGGING
 # define LOG(...) (LOGN(__VA_ARGS__), puts(""))
@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort.h"
+#include "shared.h"
+
+#define SWAP(type, lhs, rhs) do { type tmp_ = (lhs); (lhs) = (rhs); (rhs) = tmp_; } while (0)
+
+typedef struct {
+	sort_comparator compare;
+	void *context;
+} sorter;
+
+static bool less_than(const sorter *s, value lhs, value rhs) {
+	return s->compare(lhs, rhs, s->context) < 0;
+}
+
+static void insertion_sort(value *vals, unsigned length, const sorter *s) {
+	for (unsigned i = 1; i < length; i++) {
+		value val = vals[i];
+		unsigned j = i;
+
+		for (; j != 0 && less_than(s, val, vals[j - 1]); j--)
+			vals[j] = vals[j - 1];
+
+		vals[j] = val;
+	}
+}
+
+// Like `insertion_sort`, but gives up (returning false) after moving too many elements, in which
+// case `vals` is left partially sorted.
+static bool partial_insertion_sort(value *vals, unsigned length, const sorter *s) {
+	unsigned moves = 0;
+
+	for (unsigned i = 1; i < length; i++) {
+		value val = vals[i];
+		unsigned j = i;
+
+		for (; j != 0 && less_than(s, val, vals[j - 1]); j--)
+			vals[j] = vals[j - 1];
+
+		vals[j] = val;
+		moves += i - j;
+
+		if (8 < moves)
+			return false;
+	}
+
+	return true;
+}
+
+static void sift_down(value *vals, unsigned length, unsigned root, const sorter *s) {
+	while (2 * root + 1 < length) {
+		unsigned child = 2 * root + 1;
+
+		if (child + 1 < length && less_than(s, vals[child], vals[child + 1]))
+			child++;
+
+		if (!less_than(s, vals[root], vals[child]))
+			return;
+
+		SWAP(value, vals[root], vals[child]);
+		root = child;
+	}
+}
+
+static void heap_sort(value *vals, unsigned length, const sorter *s) {
+	for (unsigned i = length / 2; i != 0; i--)
+		sift_down(vals, length, i - 1, s);
+
+	for (unsigned i = length - 1; i != 0; i--) {
+		SWAP(value, vals[0], vals[i]);
+		sift_down(vals, i, 0, s);
+	}
+}
+
+// Sorts `vals[a]`, `vals[b]`, and `vals[c]`, so that the median is in `vals[b]`.
+static void sort3(value *vals, unsigned a, unsigned b, unsigned c, const sorter *s) {
+	if (less_than(s, vals[b], vals[a])) SWAP(value, vals[a], vals[b]);
+	if (less_than(s, vals[c], vals[b])) SWAP(value, vals[b], vals[c]);
+	if (less_than(s, vals[b], vals[a])) SWAP(value, vals[a], vals[b]);
+}
+
+// Moves a pivot to `vals[0]`: the median of the first, middle, and last elements, or for longer
+// arrays, the median of three such medians (which is much less likely to be a bad pivot).
+static void choose_pivot(value *vals, unsigned length, const sorter *s) {
+	unsigned mid = length / 2;
+
+	if (128 < length) {
+		sort3(vals, 0, mid, length - 1, s);
+		sort3(vals, 1, mid - 1, length - 2, s);
+		sort3(vals, 2, mid + 1, length - 3, s);
+		sort3(vals, mid - 1, mid, mid + 1, s);
+	} else {
+		sort3(vals, 0, mid, length - 1, s);
+	}
+
+	SWAP(value, vals[0], vals[mid]);
+}
+
+// Partitions `vals` around the pivot `vals[0]`, with smaller elements to its left and larger ones
+// to its right, and returns where the pivot ends up. Elements equal to the pivot can go either way,
+// so that lots of them still split evenly. `*swapped` is set to whether anything had to be moved.
+static unsigned partition_right(value *vals, unsigned length, const sorter *s, bool *swapped) {
+	value pivot = vals[0];
+	unsigned i = 1, j = length - 1;
+
+	*swapped = false;
+
+	while (true) {
+		while (i <= j && less_than(s, vals[i], pivot))
+			i++;
+
+		while (i <= j && less_than(s, pivot, vals[j]))
+			j--;
+
+		if (j <= i)
+			break;
+
+		SWAP(value, vals[i], vals[j]);
+		*swapped = true;
+		i++;
+		j--;
+	}
+
+	SWAP(value, vals[0], vals[j]);
+	return j;
+}
+
+// Like `partition_right`, but elements equal to the pivot all go to its left. This is used when the
+// pivot is equal to the element before `vals`, as then all the elements equal to it are already in
+// their final place, and don't need to be sorted again.
+static unsigned partition_left(value *vals, unsigned length, const sorter *s) {
+	value pivot = vals[0];
+	unsigned i = 1, j = length - 1;
+
+	while (true) {
+		while (i <= j && !less_than(s, pivot, vals[i]))
+			i++;
+
+		while (i <= j && less_than(s, pivot, vals[j]))
+			j--;
+
+		if (j <= i)
+			break;
+
+		SWAP(value, vals[i], vals[j]);
+		i++;
+		j--;
+	}
+
+	SWAP(value, vals[0], vals[j]);
+	return j;
+}
+
+// `leftmost` is whether `vals` is at the start of the whole array (and so whether `vals[-1]` exists),
+// and `bad_allowed` is how many more bad pivots are allowed before switching to heap sort.
+static void pdqsort(value *vals, unsigned length, const sorter *s, unsigned bad_allowed, bool leftmost) {
+	while (true) {
+		if (length <= SORT_INSERTION_MAX_LENGTH) {
+			insertion_sort(vals, length, s);
+			return;
+		}
+
+		choose_pivot(vals, length, s);
+
+		// If the pivot's equal to the element before `vals`, it's the smallest element here, so take
+		// out all the elements equal to it and just sort what's left.
+		if (!leftmost && !less_than(s, vals[-1], vals[0])) {
+			unsigned pivot = partition_left(vals, length, s);
+			vals += pivot + 1;
+			length -= pivot + 1;
+			continue;
+		}
+
+		bool swapped;
+		unsigned pivot = partition_right(vals, length, s, &swapped);
+		unsigned left_length = pivot, right_length = length - pivot - 1;
+
+		// A very uneven partition is a bad pivot. Shuffle some elements around to break up whatever
+		// pattern caused it, and if there's been too many, give up and use heap sort.
+		if (left_length < length / 8 || right_length < length / 8) {
+			if (--bad_allowed == 0) {
+				heap_sort(vals, length, s);
+				return;
+			}
+
+			if (SORT_INSERTION_MAX_LENGTH <= left_length) {
+				SWAP(value, vals[0], vals[left_length / 4]);
+				SWAP(value, vals[pivot - 1], vals[pivot - left_length / 4]);
+			}
+
+			if (SORT_INSERTION_MAX_LENGTH <= right_length) {
+				SWAP(value, vals[pivot + 1], vals[pivot + 1 + right_length / 4]);
+				SWAP(value, vals[length - 1], vals[length - right_length / 4]);
+			}
+		} else if (!swapped) {
+			// If nothing was moved, it might already be sorted, so check (without doing too much work).
+			bool left_sorted = partial_insertion_sort(vals, left_length, s);
+			bool right_sorted = partial_insertion_sort(vals + pivot + 1, right_length, s);
+
+			if (left_sorted && right_sorted)
+				return;
+
+			if (left_sorted) {
+				vals += pivot + 1;
+				length = right_length;
+				leftmost = false;
+				continue;
+			}
+
+			if (right_sorted) {
+				length = left_length;
+				continue;
+			}
+		}
+
+		// Recurse into the smaller side, and loop on the larger one, so the stack stays shallow.
+		if (left_length < right_length) {
+			pdqsort(vals, left_length, s, bad_allowed, leftmost);
+			vals += pivot + 1;
+			length = right_length;
+			leftmost = false;
+		} else {
+			pdqsort(vals + pivot + 1, right_length, s, bad_allowed, false);
+			length = left_length;
+		}
+	}
+}
+
+void sort_values(value *vals, unsigned length, sort_comparator compare, void *context) {
+	if (length < 2)
+		return;
+
+	sorter s = { .compare = compare, .context = context };
+	unsigned log2_length = 0;
+
+	for (unsigned i = length; i != 1; i >>= 1)
+		log2_length++;
+
+	pdqsort(vals, length, &s, log2_length, true);
+}
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+
+void sort_numbers(number *nums, unsigned length) {
+	if (length < SORT_RADIX_MIN_LENGTH) {
+		for (unsigned i = 1; i < length; i++) {
+			number num = nums[i];
+			unsigned j = i;
+
+			for (; j != 0 && num < nums[j - 1]; j--)
+				nums[j] = nums[j - 1];
+
+			nums[j] = num;
+		}
+
+		return;
+	}
+
+	// Flipping the sign bit makes negative numbers sort before positive ones when they're compared as
+	// unsigned numbers.
+	unsigned long long *keys = (unsigned long long *) nums;
+	unsigned long long *scratch = xmalloc(length * sizeof(unsigned long long));
+
+	// Count how often each byte appears in each position in a single pass over the numbers.
+	unsigned counts[RADIX_PASSES][RADIX_BUCKETS] = { 0 };
+
+	for (unsigned i = 0; i < length; i++) {
+		keys[i] ^= 1ULL << 63;
+
+		for (unsigned pass = 0; pass < RADIX_PASSES; pass++)
+			counts[pass][(keys[i] >> (pass * RADIX_BITS)) % RADIX_BUCKETS]++;
+	}
+
+	unsigned long long *src = keys, *dst = scratch;
+
+	for (unsigned pass = 0; pass < RADIX_PASSES; pass++) {
+		unsigned shift = pass * RADIX_BITS;
+
+		// If every number has the same byte here (eg the top bytes of small numbers), skip it.
+		if (counts[pass][(src[0] >> shift) % RADIX_BUCKETS] == length)
+			continue;
+
+		unsigned offset = 0;
+		for (unsigned bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+			unsigned count = counts[pass][bucket];
+			counts[pass][bucket] = offset;
+			offset += count;
+		}
+
+		for (unsigned i = 0; i < length; i++)
+			dst[counts[pass][(src[i] >> shift) % RADIX_BUCKETS]++] = src[i];
+
+		SWAP(unsigned long long *, src, dst);
+	}
+
+	for (unsigned i = 0; i < length; i++)
+		keys[i] = src[i] ^ (1ULL << 63);
+
+	free(scratch);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "valuedefn.h"
+#include "number.h"
+
+// Sorting routines for the elements of arrays (see `sort_array`).
+//
+// Values are sorted with a pattern-defeating quicksort: a quicksort that notices (and takes
+// advantage of) runs that are already sorted and lots of equal elements, and that switches to heap
+// sort if it keeps choosing bad pivots, so it's never quadratic. Comparators may be arbitrary Friar
+// functions, so it never reads out of bounds even if they're inconsistent. It's not stable.
+//
+// Numbers are radix sorted a byte at a time, skipping bytes that are the same for every number.
+
+#ifndef SORT_INSERTION_MAX_LENGTH
+# define SORT_INSERTION_MAX_LENGTH 24
+#endif
+
+#ifndef SORT_RADIX_MIN_LENGTH
+# define SORT_RADIX_MIN_LENGTH 64
+#endif
+
+// Returns a negative, zero, or positive number if `lhs` is less than, equal to, or greater than `rhs`.
+typedef int (*sort_comparator)(value lhs, value rhs, void *context);
+
+void sort_values(value *vals, unsigned length, sort_comparator compare, void *context);
+void sort_numbers(number *nums, unsigned length);
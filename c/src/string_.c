@@ -1,41 +1,246 @@
 #include "string_.h"
 #include "shared.h"
+#include "pool.h"
 #include <assert.h>
 #include <ctype.h>
+#include <sys/mman.h>
 
-string *new_string(char *ptr, unsigned length) {
-	string *str = xmalloc(sizeof(string));
+string *allocate_string(unsigned capacity) {
+	string *str = pool_alloc(sizeof(string) + capacity);
+
+	str->refcount = 1;
+	str->length = 0;
+	str->capacity = capacity;
+	str->ptr = str->bytes;
+	str->hash = 0;
+	str->interned = false;
+	str->mapped = false;
+	str->sliced = false;
+
+	return str;
+}
+
+string *new_mapped_string(char *ptr, unsigned length) {
+	string *str = pool_alloc(sizeof(string));
 
 	str->refcount = 1;
 	str->length = length;
+	str->capacity = length;
 	str->ptr = ptr;
+	str->hash = 0;
+	str->interned = false;
+	str->mapped = true;
+	str->sliced = false;
 
 	return str;
 }
 
+string *slice_string(string *str, unsigned start, unsigned length) {
+	assert(start <= str->length && length <= str->length - start);
+
+	if (start == 0 && length == str->length)
+		return clone_string(str);
+
+	const char *ptr = string_ptr(str) + start;
+
+	if (length < STRING_SLICE_MIN_LENGTH)
+		return new_string(ptr, length);
+
+	string *slice = pool_alloc(sizeof(string));
+
+	slice->refcount = 1;
+	slice->length = length;
+	slice->ptr = (char *) ptr;
+	slice->hash = 0;
+	slice->interned = false;
+	slice->mapped = false;
+	slice->sliced = true;
+
+	// Slices of slices point straight into the original string, so they never form chains.
+	slice->parent = clone_string(str->sliced ? str->parent : str);
+
+	return slice;
+}
+
+string *new_string(const char *ptr, unsigned length) {
+	string *str = allocate_string(length);
+
+	memcpy(str->bytes, ptr, length);
+	str->length = length;
+
+	return str;
+}
+
+static string *new_rope(string *lhs, string *rhs) {
+	string *rope = pool_alloc(sizeof(string));
+
+	rope->refcount = 1;
+	rope->length = lhs->length + rhs->length;
+	rope->ptr = NULL;
+	rope->hash = 0;
+	rope->interned = false;
+	rope->mapped = false;
+	rope->sliced = false;
+	rope->rope.lhs = clone_string(lhs);
+	rope->rope.rhs = clone_string(rhs);
+
+	return rope;
+}
+
+string *push_string(string *str, const char *ptr, unsigned length) {
+	assert(str->refcount == 1);
+
+	// We're about to write into `str`'s buffer, so it needs to have one.
+	if (is_rope(str))
+		flatten_string(str);
+
+	// Mapped strings and slices are read-only, so make a copy to write into instead.
+	if (str->mapped || str->sliced) {
+		string *copy = allocate_string(str->length + length);
+		memcpy(copy->ptr, str->ptr, str->length);
+		copy->length = str->length;
+
+		free_string(str);
+		str = copy;
+	}
+
+	if (str->capacity < str->length + length) {
+		unsigned old_capacity = str->capacity;
+		str->capacity *= 2;
+
+		if (str->capacity < str->length + length)
+			str->capacity = str->length + length;
+
+		if (str->ptr == str->bytes) {
+			str = pool_realloc(str, sizeof(string) + old_capacity, sizeof(string) + str->capacity);
+			str->ptr = str->bytes;
+		} else {
+			str->ptr = pool_realloc(str->ptr, old_capacity, str->capacity);
+		}
+	}
+
+	memcpy(str->ptr + str->length, ptr, length);
+	str->length += length;
+	str->hash = 0;
+
+	return str;
+}
+
+// Ropes can be arbitrarily deep (eg from appending thousands of pieces one at a time), so instead of
+// recursing when flattening or freeing them, we keep an explicit stack of nodes.
+typedef struct {
+	unsigned length, capacity;
+	string **nodes;
+} rope_stack;
+
+static void push_rope_stack(rope_stack *stack, string *node) {
+	if (stack->length == stack->capacity) {
+		stack->capacity *= 2;
+		stack->nodes = xrealloc(stack->nodes, stack->capacity * sizeof(string *));
+	}
+
+	stack->nodes[stack->length] = node;
+	stack->length++;
+}
+
+static rope_stack new_rope_stack(string *root) {
+	rope_stack stack = {
+		.length = 0,
+		.capacity = 8,
+		.nodes = xmalloc(8 * sizeof(string *))
+	};
+
+	push_rope_stack(&stack, root);
+	return stack;
+}
+
+// Releases the memory used by `str` itself (but not a rope's halves).
+static void release_string(string *str) {
+	if (is_rope(str)) {
+		pool_free(str, sizeof(string));
+	} else if (str->mapped) {
+		munmap(str->ptr, str->length);
+		pool_free(str, sizeof(string));
+	} else if (str->sliced) {
+		free_string(str->parent);
+		pool_free(str, sizeof(string));
+	} else if (str->ptr == str->bytes) {
+		pool_free(str, sizeof(string) + str->capacity);
+	} else {
+		pool_free(str->ptr, str->capacity);
+		pool_free(str, sizeof(string));
+	}
+}
+
 void deallocate_string(string *str) {
 	assert(str->refcount == 0);
 
-	free(str->ptr);
-	free(str);
+	if (!is_rope(str)) {
+		release_string(str);
+		return;
+	}
+
+	rope_stack stack = new_rope_stack(str);
+
+	while (stack.length != 0) {
+		string *node = stack.nodes[--stack.length];
+
+		if (!is_rope(node)) {
+			release_string(node);
+			continue;
+		}
+
+		// Only descend into halves that we held the last reference to.
+		string *halves[2] = { node->rope.lhs, node->rope.rhs };
+		for (unsigned i = 0; i < 2; i++) {
+			assert(halves[i]->refcount != 0);
+
+			halves[i]->refcount--;
+			if (halves[i]->refcount == 0)
+				push_rope_stack(&stack, halves[i]);
+		}
+
+		release_string(node);
+	}
+
+	free(stack.nodes);
 }
 
-string *index_string(const string *str, int idx) {
-	if (idx < 0) {
-		idx += str->length;
+void flatten_string(string *str) {
+	assert(is_rope(str));
 
-		if (idx < 0)
-			return NULL;
+	// Ropes may be shared, so we can't reallocate them to fit their contents inline. Instead, the
+	// contents go in their own buffer.
+	char *ptr = pool_alloc(str->length);
+	unsigned end = str->length;
+	rope_stack stack = new_rope_stack(str);
+
+	// We fill in the buffer from the back, visiting `rhs`s first. That way left-leaning ropes (which
+	// are what repeatedly appending makes) only ever need a couple of stack slots.
+	while (stack.length != 0) {
+		string *node = stack.nodes[--stack.length];
+
+		if (is_rope(node)) {
+			push_rope_stack(&stack, node->rope.lhs);
+			push_rope_stack(&stack, node->rope.rhs);
+			continue;
+		}
+
+		end -= node->length;
+		memcpy(ptr + end, node->ptr, node->length);
 	}
 
-	if (str->length <= (unsigned) idx)
-		return NULL;
+	assert(end == 0);
+	free(stack.nodes);
 
-	string *ret = allocate_string(1);
-	ret->ptr[0] = str->ptr[idx];
-	ret->length = 1;
+	string *lhs = str->rope.lhs;
+	string *rhs = str->rope.rhs;
 
-	return ret;
+	str->ptr = ptr;
+	str->capacity = str->length;
+
+	free_string(lhs);
+	free_string(rhs);
 }
 
 string *add_strings(string *lhs, string *rhs) {
@@ -45,42 +250,71 @@ string *add_strings(string *lhs, string *rhs) {
 	if (rhs->length == 0)
 		return clone_string(lhs);
 
+	if (STRING_ROPE_THRESHOLD <= lhs->length + rhs->length)
+		return new_rope(lhs, rhs);
+
 	string *str = allocate_string(lhs->length + rhs->length);
-	memcpy(str->ptr, lhs->ptr, lhs->length);
-	memcpy(str->ptr + lhs->length, rhs->ptr, rhs->length);
+	memcpy(str->ptr, string_ptr(lhs), lhs->length);
+	memcpy(str->ptr + lhs->length, string_ptr(rhs), rhs->length);
 	str->length = lhs->length + rhs->length;
 
 	return str;
 }
 
+string *append_string(string *lhs, string *rhs) {
+	if (lhs->refcount != 1) {
+		string *ret = add_strings(lhs, rhs);
+		free_string(lhs);
+		return ret;
+	}
+
+	return push_string(lhs, string_ptr(rhs), rhs->length);
+}
+
 int compare_strings(const string *lhs, const string *rhs) {
-	unsigned min_len = lhs->length < rhs->length ? lhs->length : rhs->length;
+	return compare_bytes(string_ptr(lhs), lhs->length, string_ptr(rhs), rhs->length);
+}
+
+int compare_bytes(const char *lhs, unsigned lhs_length, const char *rhs, unsigned rhs_length) {
+	unsigned min_len = lhs_length < rhs_length ? lhs_length : rhs_length;
 
 	// Compare the bytes of the strings to begin with. If they're not equal, then return that.
-	int cmp = memcmp(lhs->ptr, rhs->ptr, min_len);
+	int cmp = memcmp(lhs, rhs, min_len);
 	if (cmp != 0)
 		return cmp;
 
 	// Otherwise, the shorter string is smaller.
 	// If they have the same length and same `cmp`, they're equal
-	return lhs->length - rhs->length;
+	return lhs_length - rhs_length;
 }
 
 bool equate_strings(const string *lhs, const string *rhs) {
+	if (lhs == rhs)
+		return true;
+
 	if (lhs->length != rhs->length)
 		return false;
 
-	return !memcmp(lhs->ptr, rhs->ptr, lhs->length);
+	// Interned strings are unique, so different ones always have different contents.
+	if (lhs->interned && rhs->interned)
+		return false;
+
+	// If both hashes are already known, they can rule out most unequal strings for us.
+	if (lhs->hash != 0 && rhs->hash != 0 && lhs->hash != rhs->hash)
+		return false;
+
+	return !memcmp(string_ptr(lhs), string_ptr(rhs), lhs->length);
 }
 
 string *replicate_string(string *str, unsigned amnt) {
 	if (amnt == 1)
 		return clone_string(str);
 
+	const char *ptr = string_ptr(str);
 	string *ret = allocate_string(str->length * amnt);
 
 	for (unsigned i = 0; i < amnt; i++)
-		memcpy(ret->ptr + i*str->length, str->ptr, str->length);
+		memcpy(ret->ptr + i*str->length, ptr, str->length);
 
 	ret->length = str->length * amnt;
 
@@ -88,35 +322,31 @@ string *replicate_string(string *str, unsigned amnt) {
 }
 
 char *new_cstr_from_string(const string *str) {
+	const char *ptr = string_ptr(str);
+
 	for (unsigned i = 0; i < str->length; i++) {
-		if (str->ptr[i] == '\0')
+		if (ptr[i] == '\0')
 			return NULL;
 	}
 
 	char *cstr = xmalloc(str->length + 1);
-	memcpy(cstr, str->ptr, str->length);
+	memcpy(cstr, ptr, str->length);
 	cstr[str->length] = '\0';
 	return cstr;
 }
 
-static void push_string(string *str, unsigned *capacity, char chr) {
-	if (*capacity <= str->length) {
-		*capacity *= 2;
-		str->ptr = xrealloc(str->ptr, *capacity);
-	}
-
-	str->ptr[str->length] = chr;
-	str->length++;
+static string *push_char(string *str, char chr) {
+	return push_string(str, &chr, 1);
 }
 
 string *inspect_string(const string *str) {
+	const char *ptr = string_ptr(str);
 	string *inspected = allocate_string(str->length + 2); // the 2 is for the quotes
-	unsigned capacity = str->length + 2;
 
-	push_string(inspected, &capacity, '"');
+	inspected = push_char(inspected, '"');
 
 	for (unsigned i = 0; i < str->length; ++i) {
-		char chr = str->ptr[i];
+		char chr = ptr[i];
 
 		switch (chr) {
 		case '\n': chr = 'n'; goto slash;
@@ -128,24 +358,184 @@ string *inspect_string(const string *str) {
 		case '\"':
 		case '\'':
 		slash:
-			push_string(inspected, &capacity, '\\');
+			inspected = push_char(inspected, '\\');
 			break;
 
 		default:
 			if (isprint(chr))
 				break;
 
-			push_string(inspected, &capacity, '\\');
-			push_string(inspected, &capacity, 'x');
-			push_string(inspected, &capacity, '0' + (chr >> 4));
-			push_string(inspected, &capacity, '0' + (chr & 0xf));
+			inspected = push_char(inspected, '\\');
+			inspected = push_char(inspected, 'x');
+			inspected = push_char(inspected, '0' + (chr >> 4));
+			inspected = push_char(inspected, '0' + (chr & 0xf));
 			continue;
 		}
 
-		push_string(inspected, &capacity, chr);
+		inspected = push_char(inspected, chr);
 	}
 
-	push_string(inspected, &capacity, '"');
+	inspected = push_char(inspected, '"');
 
 	return inspected;
 }
+
+static uint64_t wymix(uint64_t lhs, uint64_t rhs) {
+	__uint128_t product = (__uint128_t) lhs * rhs;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t read64(const unsigned char *ptr) {
+	uint64_t word;
+	memcpy(&word, ptr, sizeof(uint64_t));
+	return word;
+}
+
+static uint64_t read32(const unsigned char *ptr) {
+	uint32_t word;
+	memcpy(&word, ptr, sizeof(uint32_t));
+	return word;
+}
+
+uint64_t hash_bytes(const char *ptr, unsigned length) {
+	static const uint64_t secret[4] = {
+		0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+	};
+
+	const unsigned char *bytes = (const unsigned char *) ptr;
+	uint64_t seed = secret[0], a, b;
+
+	if (length <= 16) {
+		if (length >= 4) {
+			unsigned middle = (length >> 3) << 2;
+			a = (read32(bytes) << 32) | read32(bytes + middle);
+			b = (read32(bytes + length - 4) << 32) | read32(bytes + length - 4 - middle);
+		} else if (length != 0) {
+			a = ((uint64_t) bytes[0] << 16) | ((uint64_t) bytes[length >> 1] << 8) | bytes[length - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		unsigned remaining = length;
+
+		if (remaining > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+
+			do {
+				seed = wymix(read64(bytes) ^ secret[1], read64(bytes + 8) ^ seed);
+				seed1 = wymix(read64(bytes + 16) ^ secret[2], read64(bytes + 24) ^ seed1);
+				seed2 = wymix(read64(bytes + 32) ^ secret[3], read64(bytes + 40) ^ seed2);
+				bytes += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+
+			seed ^= seed1 ^ seed2;
+		}
+
+		while (remaining > 16) {
+			seed = wymix(read64(bytes) ^ secret[1], read64(bytes + 8) ^ seed);
+			bytes += 16;
+			remaining -= 16;
+		}
+
+		a = read64(bytes + remaining - 16);
+		b = read64(bytes + remaining - 8);
+	}
+
+	uint64_t hash = wymix(secret[1] ^ length, wymix(a ^ secret[1], b ^ seed));
+
+	// `0` is used to mark strings whose hashes haven't been computed yet.
+	return hash == 0 ? 1 : hash;
+}
+
+#ifndef INTERNED_STRINGS_INITIAL_CAPACITY
+# define INTERNED_STRINGS_INITIAL_CAPACITY 64
+#endif
+
+// The table of interned strings. It uses open addressing with linear probing, and its capacity is
+// always a power of two that's at least twice its length. Each entry holds a reference to its string.
+static struct {
+	unsigned length, capacity;
+	string **entries;
+} interned_strings;
+
+static string **find_interned_string(const char *ptr, unsigned length, uint64_t hash) {
+	unsigned mask = interned_strings.capacity - 1;
+
+	for (unsigned i = hash & mask; ; i = (i + 1) & mask) {
+		string *entry = interned_strings.entries[i];
+
+		if (entry == NULL)
+			return &interned_strings.entries[i];
+
+		if (entry->hash == hash && entry->length == length && !memcmp(entry->ptr, ptr, length))
+			return &interned_strings.entries[i];
+	}
+}
+
+static void grow_interned_strings(void) {
+	unsigned old_capacity = interned_strings.capacity;
+	string **old_entries = interned_strings.entries;
+
+	interned_strings.capacity = old_capacity == 0 ? INTERNED_STRINGS_INITIAL_CAPACITY : old_capacity * 2;
+	interned_strings.entries = xmalloc(interned_strings.capacity * sizeof(string *));
+
+	for (unsigned i = 0; i < interned_strings.capacity; i++)
+		interned_strings.entries[i] = NULL;
+
+	for (unsigned i = 0; i < old_capacity; i++) {
+		if (old_entries[i] != NULL)
+			*find_interned_string(old_entries[i]->ptr, old_entries[i]->length, old_entries[i]->hash) = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+static string *intern_bytes(const char *ptr, unsigned length, uint64_t hash) {
+	if (interned_strings.capacity < 2 * (interned_strings.length + 1))
+		grow_interned_strings();
+
+	string **entry = find_interned_string(ptr, length, hash);
+
+	if (*entry == NULL) {
+		// Interned strings are always given their own copy, with a trailing nul byte so they can be used
+		// as identifiers.
+		string *str = allocate_string(length + 1);
+		memcpy(str->ptr, ptr, length);
+		str->ptr[length] = '\0';
+		str->length = length;
+		str->hash = hash;
+		str->interned = true;
+
+		*entry = str;
+		interned_strings.length++;
+	}
+
+	return *entry;
+}
+
+string *intern_string(string *str) {
+	if (str->interned)
+		return str;
+
+	string *interned = clone_string(intern_bytes(string_ptr(str), str->length, hash_string(str)));
+	free_string(str);
+
+	return interned;
+}
+
+const char *intern_identifier(const char *ptr, unsigned length) {
+	return intern_bytes(ptr, length, hash_bytes(ptr, length))->ptr;
+}
+
+void free_interned_strings(void) {
+	for (unsigned i = 0; i < interned_strings.capacity; i++) {
+		if (interned_strings.entries[i] != NULL)
+			free_string(interned_strings.entries[i]);
+	}
+
+	free(interned_strings.entries);
+	interned_strings.length = interned_strings.capacity = 0;
+	interned_strings.entries = NULL;
+}
@@ -4,20 +4,99 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "shared.h"
 #include "valuedefn.h"
 
+#ifndef STRING_ROPE_THRESHOLD
+# define STRING_ROPE_THRESHOLD 1024
+#endif
+
+#ifndef STRING_SLICE_MIN_LENGTH
+# define STRING_SLICE_MIN_LENGTH 64
+#endif
+
 // Note that strings are not nul terminated, and as such aren't compatible with any of the
 // builtin `strxxx` family of functions (eg `strdup`).
-typedef struct {
-	VALUE_ALIGNMENT char *ptr;
+//
+// Normally, a string's contents are stored inline right after it (in `bytes`), so each string is a
+// single allocation and `ptr` just points to `bytes`. The only time `ptr` points elsewhere is for
+// strings whose contents live in their own buffer (such as flattened ropes), which `ptr` owns.
+//
+// When adding strings whose combined length is at least `STRING_ROPE_THRESHOLD`, we don't copy
+// them; instead, we make a "rope," which just holds references to both halves. Ropes have a `NULL`
+// `ptr`, and are flattened the first time their contents are needed (see `string_ptr`). This means
+// building large strings out of lots of pieces only does linear work.
+//
+// Strings can also have their contents mapped from a file (see `new_mapped_string`), in which case
+// `ptr` points to the mapping, or be a slice of another string (see `slice_string`), in which case
+// `ptr` points into the `parent`'s contents. Neither is ever modified in place; appending to one
+// copies it.
+//
+// Strings can also be "interned" (see `intern_string`), which means they're the only string with
+// those contents that's in the interning table. Two different interned strings are thus never equal,
+// so comparing them is just a pointer comparison.
+typedef struct string string;
+struct string {
+	VALUE_ALIGNMENT char *ptr; // `NULL` if this is a rope that hasn't been flattened yet.
 	unsigned refcount, length;
-} string;
 
-string *new_string(char *ptr, unsigned length);
+	union {
+		// How many bytes `ptr` can hold; it's only ever larger than `length` for strings which have
+		// been appended to in place (see `push_string`).
+		unsigned capacity;
+
+		struct {
+			string *lhs, *rhs;
+		} rope;
+
+		// For slices, the string whose contents they point into (which is never a slice itself).
+		string *parent;
+	};
+
+	// The string's hash, or `0` if it hasn't been computed yet (see `hash_string`).
+	uint64_t hash;
+	bool interned;
+	bool mapped; // If set, `ptr` is a mapping of `length` bytes, which is unmapped when it's freed.
+	bool sliced; // If set, this string holds a reference to `parent`.
+
+	char bytes[];
+};
+
+// Creates a new string containing a copy of the first `length` bytes of `ptr`.
+string *new_string(const char *ptr, unsigned length);
+
+// Creates a new empty string which can hold `capacity` bytes before needing to be reallocated.
+string *allocate_string(unsigned capacity);
+
+// Creates a new string out of the `length` bytes mapped (with `mmap`) at `ptr`, which it takes
+// ownership of.
+string *new_mapped_string(char *ptr, unsigned length);
+
+// Returns the `length` bytes of `str` starting at `start`, which must be within `str`. Long enough
+// slices just point into `str`'s contents (keeping it alive), but ones shorter than
+// `STRING_SLICE_MIN_LENGTH` are copied: a copy that small costs about the same as a slice does, and it
+// means lots of short slices (such as tokens) don't keep a large string around.
+string *slice_string(string *str, unsigned start, unsigned length);
+
+// Appends `length` bytes from `ptr` onto `str`, which must have no other references. As this may
+// need to reallocate `str`, the string to use afterwards is returned.
+string *push_string(string *str, const char *ptr, unsigned length);
+
+static inline bool is_rope(const string *str) {
+	return str->ptr == NULL;
+}
+
+// Copies a rope's contents into a single buffer, releasing its halves.
+void flatten_string(string *str);
+
+// Returns the contents of `str`, flattening it first if needed. Always use this instead of reading
+// `ptr` directly. (Flattening doesn't change a string's value, so it's fine for `const` strings.)
+static inline char *string_ptr(const string *str) {
+	if (is_rope(str))
+		flatten_string((string *) str);
 
-static inline string *allocate_string(unsigned capacity) {
-	return new_string(xmalloc(capacity), 0);
+	return str->ptr;
 }
 
 void deallocate_string(string *str);
@@ -35,9 +114,15 @@ static inline string *clone_string(string *str) {
 	return str;
 }
 
-string *index_string(const string *str, int idx);
 string *add_strings(string *lhs, string *rhs);
+
+// Like `add_strings`, except ownership of `lhs` is given to this function. If `lhs` has no other
+// references, `rhs` is appended to it in place (see `push_string`) and it's returned.
+string *append_string(string *lhs, string *rhs);
 int compare_strings(const string *lhs, const string *rhs);
+
+// Like `compare_strings`, but for raw bytes.
+int compare_bytes(const char *lhs, unsigned lhs_length, const char *rhs, unsigned rhs_length);
 bool equate_strings(const string *lhs, const string *rhs);
 string *replicate_string(string *str, unsigned amnt);
 
@@ -45,3 +130,25 @@ string *replicate_string(string *str, unsigned amnt);
 char *new_cstr_from_string(const string *str);
 
 string *inspect_string(const string *str);
+
+// Hashes `length` bytes of `ptr` (using wyhash). This never returns `0`.
+uint64_t hash_bytes(const char *ptr, unsigned length);
+
+// Returns `str`'s hash, computing and caching it if needed.
+static inline uint64_t hash_string(const string *str) {
+	if (str->hash == 0)
+		((string *) str)->hash = hash_bytes(string_ptr(str), str->length);
+
+	return str->hash;
+}
+
+// Returns the interned string with the same contents as `str`, adding it to the table if needed.
+// Ownership of `str` is given to this function.
+string *intern_string(string *str);
+
+// Interns `length` bytes of `ptr`, returning the (nul-terminated) contents of the interned string.
+// As interned strings live until `free_interned_strings`, identifiers are interned this way so they
+// can be compared by pointer.
+const char *intern_identifier(const char *ptr, unsigned length);
+
+void free_interned_strings(void);
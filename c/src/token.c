@@ -1,22 +1,244 @@
 #include "token.h"
 #include "shared.h"
 #include "value.h"
+#include "compile.h"
 
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
 
+// Define `TOKENIZER_SIMD` to have the hot loops of the tokenizer (skipping whitespace and comments,
+// and scanning identifiers and strings) classify a whole vector of bytes at a time with SSE2 or AVX2.
+// Runs of these are usually short enough in real programs that this isn't any faster than scanning
+// a byte at a time (see `bench_lexer`), so the scalar versions are the default.
+//
+// The vector loops only ever do aligned loads, which can't cross into another page, so it's fine
+// that they read a little past the stream's nul terminator. (AddressSanitizer doesn't know that
+// though, so the scalar versions are always used under it.)
+#if defined(__SANITIZE_ADDRESS__) || !defined(TOKENIZER_SIMD)
+// Nothing to do; these use the scalar fallbacks.
+#elif defined(__AVX2__)
+# include <immintrin.h>
+# define TOKENIZER_SIMD_WIDTH 32
+typedef __m256i byte_vector;
+# define load_vector(ptr) _mm256_load_si256((const __m256i *) (ptr))
+# define splat(c) _mm256_set1_epi8(c)
+# define vector_or(a, b) _mm256_or_si256(a, b)
+# define bytes_equal(a, b) _mm256_cmpeq_epi8(a, b)
+# define bytes_less_than(a, b) _mm256_cmpgt_epi8(b, a)
+# define bytes_sub(a, b) _mm256_sub_epi8(a, b)
+# define to_bitmask(v) ((uint32_t) _mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+# define TOKENIZER_SIMD_WIDTH 16
+typedef __m128i byte_vector;
+# define load_vector(ptr) _mm_load_si128((const __m128i *) (ptr))
+# define splat(c) _mm_set1_epi8(c)
+# define vector_or(a, b) _mm_or_si128(a, b)
+# define bytes_equal(a, b) _mm_cmpeq_epi8(a, b)
+# define bytes_less_than(a, b) _mm_cmplt_epi8(a, b)
+# define bytes_sub(a, b) _mm_sub_epi8(a, b)
+# define to_bitmask(v) ((uint32_t) _mm_movemask_epi8(v))
+#endif
+
+#ifdef TOKENIZER_SIMD_WIDTH
+# define FULL_BITMASK ((uint32_t) ((1ull << TOKENIZER_SIMD_WIDTH) - 1))
+
+// Sets each byte in `bytes` that's within `lo..=hi` to `0xff`. (There's no unsigned byte comparison,
+// so the range is shifted down to start at -128 and compared as signed.)
+static inline byte_vector bytes_in_range(byte_vector bytes, char lo, char hi) {
+	byte_vector shifted = bytes_sub(bytes, splat((char) (lo + 128)));
+	return bytes_less_than(shifted, splat((char) (-128 + (hi - lo) + 1)));
+}
+
+static inline uint32_t identifier_bitmask(byte_vector bytes) {
+	byte_vector lowercased = vector_or(bytes, splat(0x20));
+
+	return to_bitmask(vector_or(
+		vector_or(bytes_in_range(lowercased, 'a', 'z'), bytes_in_range(bytes, '0', '9')),
+		bytes_equal(bytes, splat('_'))
+	));
+}
+
+static inline uint32_t whitespace_bitmask(byte_vector bytes) {
+	return to_bitmask(vector_or(bytes_in_range(bytes, '\t', '\r'), bytes_equal(bytes, splat(' '))));
+}
+
+static inline uint32_t newline_bitmask(byte_vector bytes) {
+	return to_bitmask(bytes_equal(bytes, splat('\n')));
+}
+
+static inline uint32_t nul_bitmask(byte_vector bytes) {
+	return to_bitmask(bytes_equal(bytes, splat('\0')));
+}
+
+// Returns the aligned block containing `ptr`, and sets `start_bitmask` to the bytes at or after `ptr`.
+static inline const char *align_block(const char *ptr, uint32_t *start_bitmask) {
+	const char *block = (const char *) ((uintptr_t) ptr & ~(uintptr_t) (TOKENIZER_SIMD_WIDTH - 1));
+	*start_bitmask = FULL_BITMASK & (FULL_BITMASK << (ptr - block));
+	return block;
+}
+
+# define lowest_bit(bitmask) ((unsigned) __builtin_ctz(bitmask))
+
+// Without `popcnt`, `__builtin_popcount` is a library call. Newlines are sparse, so clearing the
+// lowest bit until there's none left is usually quicker.
+static inline unsigned count_bits(uint32_t bitmask) {
+# ifdef __POPCNT__
+	return __builtin_popcount(bitmask);
+# else
+	unsigned count = 0;
+
+	for (; bitmask != 0; bitmask &= bitmask - 1)
+		count++;
+
+	return count;
+# endif
+}
+#endif
+
+// Most runs of whitespace, identifiers, and strings are only a few bytes long, which is quicker to
+// check one byte at a time than to set up vectors for. So, with `TOKENIZER_SIMD`, the first few bytes
+// are checked on their own before switching over.
+#ifndef TOKENIZER_SCALAR_PREFIX
+# define TOKENIZER_SCALAR_PREFIX 8
+#endif
+
+// Returns the first byte at or after `ptr` that can't be part of an identifier.
+static const char *skip_identifier(const char *ptr) {
+	for (unsigned i = 0; i < TOKENIZER_SCALAR_PREFIX; i++, ptr++) {
+		if (!isalnum(*ptr) && *ptr != '_')
+			return ptr;
+	}
+
+#ifdef TOKENIZER_SIMD_WIDTH
+	uint32_t start;
+	const char *block = align_block(ptr, &start);
+	uint32_t stop = ~identifier_bitmask(load_vector(block)) & start;
+
+	while (stop == 0) {
+		block += TOKENIZER_SIMD_WIDTH;
+		stop = ~identifier_bitmask(load_vector(block)) & FULL_BITMASK;
+	}
+
+	return block + lowest_bit(stop);
+#else
+	while (isalnum(*ptr) || *ptr == '_')
+		ptr++;
+
+	return ptr;
+#endif
+}
+
+// Returns the first non-whitespace byte at or after `ptr`, adding the newlines skipped to `newlines`.
+static const char *skip_whitespace(const char *ptr, unsigned *newlines) {
+	for (unsigned i = 0; i < TOKENIZER_SCALAR_PREFIX; i++, ptr++) {
+		if (!isspace(*ptr))
+			return ptr;
+
+		if (*ptr == '\n')
+			++*newlines;
+	}
+
+#ifdef TOKENIZER_SIMD_WIDTH
+	uint32_t start;
+	const char *block = align_block(ptr, &start);
+
+	while (true) {
+		byte_vector bytes = load_vector(block);
+		uint32_t stop = ~whitespace_bitmask(bytes) & start;
+		uint32_t skipped = stop == 0 ? start : start & ((1u << lowest_bit(stop)) - 1);
+
+		*newlines += count_bits(newline_bitmask(bytes) & skipped);
+
+		if (stop != 0)
+			return block + lowest_bit(stop);
+
+		block += TOKENIZER_SIMD_WIDTH;
+		start = FULL_BITMASK;
+	}
+#else
+	for (; isspace(*ptr); ptr++) {
+		if (*ptr == '\n')
+			++*newlines;
+	}
+
+	return ptr;
+#endif
+}
+
+// Returns the first newline or nul byte at or after `ptr`.
+static const char *skip_line(const char *ptr) {
+#ifdef TOKENIZER_SIMD_WIDTH
+	uint32_t start;
+	const char *block = align_block(ptr, &start);
+	byte_vector bytes = load_vector(block);
+	uint32_t stop = (newline_bitmask(bytes) | nul_bitmask(bytes)) & start;
+
+	while (stop == 0) {
+		block += TOKENIZER_SIMD_WIDTH;
+		bytes = load_vector(block);
+		stop = newline_bitmask(bytes) | nul_bitmask(bytes);
+	}
+
+	return block + lowest_bit(stop);
+#else
+	while (*ptr != '\n' && *ptr != '\0')
+		ptr++;
+
+	return ptr;
+#endif
+}
+
+// Returns the first byte at or after `ptr` which a string literal needs to handle specially (its
+// closing `quote`, a backslash, a newline, or a nul byte).
+static const char *skip_plain_string_bytes(const char *ptr, char quote) {
+	for (unsigned i = 0; i < TOKENIZER_SCALAR_PREFIX; i++, ptr++) {
+		if (*ptr == quote || *ptr == '\\' || *ptr == '\n' || *ptr == '\0')
+			return ptr;
+	}
+
+#ifdef TOKENIZER_SIMD_WIDTH
+	uint32_t start;
+	const char *block = align_block(ptr, &start);
+
+	while (true) {
+		byte_vector bytes = load_vector(block);
+		uint32_t stop = to_bitmask(vector_or(
+			bytes_equal(bytes, splat(quote)),
+			bytes_equal(bytes, splat('\\'))
+		)) | newline_bitmask(bytes) | nul_bitmask(bytes);
+
+		stop &= start;
+		if (stop != 0)
+			return block + lowest_bit(stop);
+
+		block += TOKENIZER_SIMD_WIDTH;
+		start = FULL_BITMASK;
+	}
+#else
+	while (*ptr != quote && *ptr != '\\' && *ptr != '\n' && *ptr != '\0')
+		ptr++;
+
+	return ptr;
+#endif
+}
+
 tokenizer new_tokenizer(const char *filename, const char *stream) {
 	return (tokenizer) {
 		.stream = stream,
 		.filename = filename,
+		.end = NULL,
 		.line_number = 1,
-		.prev = (token) { .kind = TOKEN_KIND_UNDEFINED }
+		.prev = (token) { .kind = TOKEN_KIND_UNDEFINED },
+		.arena = NULL
 	};
 }
 
 #define parse_error(tzr, ...) (\
+	compile_parsed_functions(), \
 	fprintf(stderr, "syntax error at %s:%d: ", tzr->filename, tzr->line_number),\
 	fprintf(stderr, __VA_ARGS__), \
 	fputc('\n', stderr), \
@@ -61,41 +283,53 @@ static token parse_number(tokenizer *tzr) {
 	};
 }
 
+// Keywords are looked up in a perfect hash table keyed on their first and last bytes. The hash
+// function was found by searching for small multipliers that give every keyword its own slot; if
+// you add a keyword, make sure it doesn't collide with an existing one.
+#define KEYWORD_HASH(start, length) \
+	(((unsigned char) (start)[0] + 2 * (unsigned char) (start)[(length) - 1]) & 31)
+
+typedef struct {
+	const char *name;
+	unsigned length;
+	token_kind kind;
+	value val; // Only used for `TOKEN_KIND_LITERAL`s.
+} keyword;
+
+static const keyword keywords[32] = {
+	[1]  = { "while",    5, TOKEN_KIND_WHILE },
+	[2]  = { "function", 8, TOKEN_KIND_FUNCTION },
+	[4]  = { "local",    5, TOKEN_KIND_LOCAL },
+	[6]  = { "null",     4, TOKEN_KIND_LITERAL, VALUE_NULL },
+	[10] = { "for",      3, TOKEN_KIND_FOR },
+	[13] = { "continue", 8, TOKEN_KIND_CONTINUE },
+	[14] = { "return",   6, TOKEN_KIND_RETURN },
+	[15] = { "else",     4, TOKEN_KIND_ELSE },
+	[16] = { "false",    5, TOKEN_KIND_LITERAL, VALUE_FALSE },
+	[17] = { "import",   6, TOKEN_KIND_IMPORT },
+	[21] = { "if",       2, TOKEN_KIND_IF },
+	[24] = { "break",    5, TOKEN_KIND_BREAK },
+	[30] = { "true",     4, TOKEN_KIND_LITERAL, VALUE_TRUE },
+	[31] = { "global",   6, TOKEN_KIND_GLOBAL },
+};
+
 static token parse_identifier(tokenizer *tzr) {
 	const char *start = tzr->stream;
 
-	// find the length of the identifier.
-	while (is_alnum_or_underscore(peek(tzr)))
-		advance(tzr);
-
+	// find the length of the identifier. (Identifiers can't contain newlines, so we don't need to use
+	// `advance`.)
+	tzr->stream = skip_identifier(start);
 	unsigned length = tzr->stream - start;
 
 	// check for predefined identifiers
-#define CHECK_FOR_KEYWORD(keyword, ...) \
-	do { \
-		if (!strncmp(start, keyword, sizeof(keyword) - 1)) { \
-			return (token) { .kind = __VA_ARGS__ }; \
-		} \
-	} while(0)
-	CHECK_FOR_KEYWORD("true", TOKEN_KIND_LITERAL, .val = VALUE_TRUE);
-	CHECK_FOR_KEYWORD("false", TOKEN_KIND_LITERAL, .val = VALUE_FALSE);
-	CHECK_FOR_KEYWORD("null", TOKEN_KIND_LITERAL, .val = VALUE_NULL);
-	CHECK_FOR_KEYWORD("global", TOKEN_KIND_GLOBAL);
-	CHECK_FOR_KEYWORD("function", TOKEN_KIND_FUNCTION);
-	CHECK_FOR_KEYWORD("local", TOKEN_KIND_LOCAL);
-	CHECK_FOR_KEYWORD("if", TOKEN_KIND_IF);
-	CHECK_FOR_KEYWORD("else", TOKEN_KIND_ELSE);
-	CHECK_FOR_KEYWORD("while", TOKEN_KIND_WHILE);
-	CHECK_FOR_KEYWORD("for", TOKEN_KIND_FOR);
-	CHECK_FOR_KEYWORD("break", TOKEN_KIND_BREAK);
-	CHECK_FOR_KEYWORD("continue", TOKEN_KIND_CONTINUE);
-	CHECK_FOR_KEYWORD("return", TOKEN_KIND_RETURN);
-#undef CHECK_FOR_KEYWORD
+	const keyword *kw = &keywords[KEYWORD_HASH(start, length)];
+	if (kw->length == length && !memcmp(start, kw->name, length))
+		return (token) { .kind = kw->kind, .val = kw->val };
 
 	// it's a normal identifier, return that.
 	return (token) {
 		.kind = TOKEN_KIND_IDENTIFIER,
-		.identifier = strndup(start, length)
+		.identifier = intern_identifier(start, length)
 	};
 }
 
@@ -144,51 +378,42 @@ static token parse_string(tokenizer *tzr) {
 	char quote = peek_advance(tzr);
 	assert(quote == '\'' || quote == '\"');
 
-	unsigned length = 0;
-	unsigned capacity = 8;
-	char *str = xmalloc(capacity); // no need for `+1` because strings dont have trailing `\0`.
-
+	string *str = allocate_string(8);
 	unsigned starting_line = tzr->line_number;
 
 	char c;
-	while ((c = peek_advance(tzr)) != quote) {
+	while (true) {
+		// Copy over everything up to the next byte that needs special handling all at once.
+		const char *plain = tzr->stream;
+		tzr->stream = skip_plain_string_bytes(plain, quote);
+		str = push_string(str, plain, tzr->stream - plain);
+
+		if ((c = peek_advance(tzr)) == quote)
+			break;
+
 		if (c == '\0')
 			parse_error(tzr, "unterminated quote encountered starting on line %d", starting_line);
 
 		if (c == '\\')
 			c = get_escape_char(tzr);
 
-		if (length == capacity) {
-			capacity *= 2;
-			str = xrealloc(str, capacity);
-		}
-
-		str[length++] = c;
+		str = push_string(str, &c, 1);
 	}
 
 	return (token) {
 		.kind = TOKEN_KIND_LITERAL,
-		.val = new_string_value(new_string(str, length))
+		// Literals are interned so that they're only stored once, and compare by pointer.
+		.val = intern_string_value(new_string_value(str))
 	};
 }
 
 static void strip_leading_whitespace_and_comments(tokenizer *tzr) {
 	while (true) {
-		char c = peek(tzr);
-
-		// EOF encountered, nothin gleft to strip
-		if (c == '\0')
-			return;
-
-		if (isspace(c)) {
-			advance(tzr);
-			continue;
-		}
+		tzr->stream = skip_whitespace(tzr->stream, &tzr->line_number);
 
-		// only c-style line comments are recognized
-		if (c == '/' && tzr->stream[1] == '/') {
-			while (c != '\0' && c != '\n')
-				c = peek_advance(tzr);
+		// only c-style line comments are recognized. (The newline at the end is skipped as whitespace.)
+		if (tzr->stream[0] == '/' && tzr->stream[1] == '/') {
+			tzr->stream = skip_line(tzr->stream);
 			continue;
 		}
 
@@ -208,8 +433,12 @@ token next_token(tokenizer *tzr) {
 	strip_leading_whitespace_and_comments(tzr);
 	char c = peek(tzr);
 
-	if (c == '\0')
+	if (c == '\0') {
+		if (tzr->end != NULL && tzr->stream != tzr->end)
+			parse_error(tzr, "unexpected NUL byte in source code");
+
 		return (token) { .kind = TOKEN_KIND_UNDEFINED };
+	}
 
 	if (isdigit(c))
 		return parse_number(tzr);
@@ -1,6 +1,7 @@
 #pragma once
 #include <stdio.h>
 #include "valuedefn.h"
+#include "arena.h"
 
 typedef enum {
 	// Indicates that the token isn't actually a token.
@@ -46,14 +47,16 @@ typedef struct {
 	token_kind kind;
 	union {
 		value val;
-		char *identifier;
+		const char *identifier;
 	};
 } token;
 
 typedef struct {
 	const char *stream, *filename;
+	const char *end; // Where the source code ends, if known, to tell it apart from a stray NUL byte.
 	unsigned line_number;
 	token prev;
+	arena *arena; // Where the parser allocates AST nodes.
 } tokenizer;
 
 tokenizer new_tokenizer(const char *filename, const char *stream);
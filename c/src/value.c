@@ -24,9 +24,12 @@ void dump_value(FILE *out, value val) {
 		fputs("Null()", out);
 		break;
 
-	case VALUE_KIND_STRING:
-		fprintf(out, "String(%.*s)", as_string(val)->length, as_string(val)->ptr);
+	case VALUE_KIND_STRING: {
+		string_view view;
+		view_string_value(val, &view);
+		fprintf(out, "String(%.*s)", view.length, view.ptr);
 		break;
+	}
 
 	case VALUE_KIND_NUMBER:
 		fprintf(out, "Number(%lld)", as_number(val));
@@ -37,7 +40,8 @@ void dump_value(FILE *out, value val) {
 void free_value(value val) {
 	switch (classify(val)) {
 	case VALUE_KIND_STRING:
-		free_string(as_string(val));
+		if (!is_small_string(val))
+			free_string(as_string(val));
 		break;
 
 	case VALUE_KIND_ARRAY:
@@ -57,7 +61,9 @@ void free_value(value val) {
 value clone_value(value val) {
 	switch (classify(val)) {
 	case VALUE_KIND_STRING:
-		return new_string_value(clone_string(as_string(val)));
+		if (!is_small_string(val))
+			clone_string(as_string(val));
+		return val;
 
 	case VALUE_KIND_ARRAY:
 		return new_array_value(clone_array(as_array(val)));
@@ -114,12 +120,17 @@ value index_value(value val, value idx) {
 
 	switch (classify(val)) {
 	case VALUE_KIND_STRING: {
-		string *str = index_string(as_string(val), num_idx);
+		string_view view;
+		view_string_value(val, &view);
 
-		if (str == NULL)
-			die_with_stacktrace("index %lld out of bounds for string of length %u", num_idx, as_string(val)->length);
+		// Allow for negative indexing.
+		if (num_idx < 0)
+			num_idx += view.length;
 
-		return new_string_value(str);
+		if (num_idx < 0 || view.length <= num_idx)
+			die_with_stacktrace("index %lld out of bounds for string of length %u", as_number(idx), view.length);
+
+		return new_small_string_value(&view.ptr[num_idx], 1);
 	}
 
 	case VALUE_KIND_ARRAY: {
@@ -153,21 +164,26 @@ value not_value(value val) {
 string *value_to_string(value val) {
 	switch (classify(val)) {
 	case VALUE_KIND_STRING:
+		if (is_small_string(val)) {
+			string_view view;
+			view_string_value(val, &view);
+			return new_string(view.ptr, view.length);
+		}
+
 		return clone_string(as_string(val));
 
 	case VALUE_KIND_NUMBER:
 		return number_to_string(as_number(val));
 
-	// `new_string` requires ownership of its string, so we `strdup`.
 	case VALUE_KIND_BOOLEAN:
 		if (val == VALUE_TRUE) {
-			return new_string(strdup("true"), 4);
+			return new_string("true", 4);
 		} else {
-			return new_string(strdup("false"), 5);
+			return new_string("false", 5);
 		}
 
 	case VALUE_KIND_NULL:
-		return new_string(strdup("null"), 4);
+		return new_string("null", 4);
 
 	case VALUE_KIND_ARRAY:
 		return array_to_string(as_array(val));
@@ -196,6 +212,25 @@ value add_values(value lhs, value rhs) {
 
 	case VALUE_KIND_STRING:
 	string: {
+		// Small strings that fit together into another small string don't need to be allocated.
+		if (is_small_string(lhs) && is_small_string(rhs)) {
+			unsigned lhs_length = string_value_length(lhs);
+			unsigned rhs_length = string_value_length(rhs);
+
+			if (lhs_length == 0)
+				return rhs;
+
+			if (rhs_length == 0)
+				return lhs;
+
+			if (lhs_length + rhs_length <= SMALL_STRING_MAX_LENGTH) {
+				return VALUE_TAG_SMALL_STRING
+					| ((lhs_length + rhs_length) << 3)
+					| (lhs & ~(value) 0xff)
+					| ((rhs >> 8) << (8 * (lhs_length + 1)));
+			}
+		}
+
 		string *l = value_to_string(lhs);
 		string *r = value_to_string(rhs);
 
@@ -212,6 +247,30 @@ value add_values(value lhs, value rhs) {
 	}
 }
 
+value add_values_in_place(value lhs, value rhs) {
+	if (is_string(lhs) && !is_small_string(lhs)) {
+		// Appending a string onto a unique string doesn't need `rhs` to be converted at all.
+		if (as_string(lhs)->refcount == 1 && is_string(rhs)) {
+			string_view view;
+			view_string_value(rhs, &view);
+			return new_string_value(push_string(as_string(lhs), view.ptr, view.length));
+		}
+
+		string *r = value_to_string(rhs);
+		string *ret = append_string(as_string(lhs), r);
+		free_string(r);
+
+		return new_string_value(ret);
+	}
+
+	if (is_array(lhs) && is_array(rhs))
+		return new_array_value(append_arrays(as_array(lhs), as_array(rhs)));
+
+	value ret = add_values(lhs, rhs);
+	free_value(lhs);
+	return ret;
+}
+
 value subtract_values(value lhs, value rhs) {
 	// Yes its backwards intentionally; English is weird.
 	if (!is_number(lhs) || !is_number(rhs)) {
@@ -232,11 +291,16 @@ value multiply_values(value lhs, value rhs) {
 	case VALUE_KIND_NUMBER:
 		return new_number_value(as_number(lhs) * amnt);
 
-	case VALUE_KIND_STRING:
+	case VALUE_KIND_STRING: {
 		if (amnt < 0)
 			die_with_stacktrace("can only multiply strings by nonnegative integers (%lld invalid).", amnt);
 
-		return new_string_value(replicate_string(as_string(lhs), amnt));
+		string *str = value_to_string(lhs);
+		string *ret = replicate_string(str, amnt);
+		free_string(str);
+
+		return new_string_value(ret);
+	}
 
 	case VALUE_KIND_ARRAY:
 		if (amnt < 0)
@@ -280,8 +344,13 @@ int compare_values(value lhs, value rhs) {
 	case VALUE_KIND_ARRAY:
 		return compare_arrays(as_array(lhs), as_array(rhs));
 
-	case VALUE_KIND_STRING:
-		return compare_strings(as_string(lhs), as_string(rhs));
+	case VALUE_KIND_STRING: {
+		string_view lhs_view, rhs_view;
+		view_string_value(lhs, &lhs_view);
+		view_string_value(rhs, &rhs_view);
+
+		return compare_bytes(lhs_view.ptr, lhs_view.length, rhs_view.ptr, rhs_view.length);
+	}
 
 	default:
 		die_with_stacktrace("can only compare numbers, arrays, and strings, not %s", value_name(lhs));
@@ -306,6 +375,11 @@ bool equate_values(value lhs, value rhs) {
 		return false; // If `lhs` isn't identical to `rhs`, then they're not equivalent.
 
 	case VALUE_KIND_STRING:
+		// Strings are always small when they're short enough, so small strings are only ever equal
+		// to identical values (which we checked above).
+		if (is_small_string(lhs) || is_small_string(rhs))
+			return false;
+
 		return equate_strings(as_string(lhs), as_string(rhs));
 
 	case VALUE_KIND_ARRAY:
@@ -314,5 +388,12 @@ bool equate_values(value lhs, value rhs) {
 }
 
 string *inspect_value(value val) {
-	return is_string(val) ? inspect_string(as_string(val)) : value_to_string(val);
+	if (!is_string(val))
+		return value_to_string(val);
+
+	string *str = value_to_string(val);
+	string *inspected = inspect_string(str);
+	free_string(str);
+
+	return inspected;
 }
@@ -27,6 +27,11 @@ which means the bottom three bits are used for storing information.
 
 As such, `number` is really a 61 bit integer, as three bits are used for tagging.
 
+Strings of up to `SMALL_STRING_MAX_LENGTH` bytes aren't allocated at all: they're packed directly
+into the `value`, with their length in bits 3-5 and their bytes in the upper seven bytes (the first
+byte being the lowest). Strings are always stored this way when they're short enough, so a heap
+string is never equal to a small one, and two small strings are equal iff their values are.
+
 The scheme is laid out as follows:
 000...000 = VALUE_FALSE
 000...001 = VALUE_NULL
@@ -37,6 +42,7 @@ XXX...001 = user-defined function
 XXX...010 = ary
 XXX...011 = builtin function
 XXX...100 = number
+XXX...101 = small string
 */
 enum {
 	VALUE_TAG_STRING           = 0,
@@ -44,9 +50,12 @@ enum {
 	VALUE_TAG_ARRAY            = 2,
 	VALUE_TAG_BUILTIN_FUNCTION = 3,
 	VALUE_TAG_NUMBER           = 4,
+	VALUE_TAG_SMALL_STRING     = 5,
 	VALUE_TAG_MASK             = 7,
 };
 
+#define SMALL_STRING_MAX_LENGTH 7
+
 /*
  * An enum used to indicate what type a `value` is.
  *
@@ -76,6 +85,9 @@ static inline value_kind classify(value val) {
 	if (val == VALUE_TRUE || val == VALUE_FALSE)
 		return VALUE_KIND_BOOLEAN;
 
+	if ((val & VALUE_TAG_MASK) == VALUE_TAG_SMALL_STRING)
+		return VALUE_KIND_STRING;
+
 	return val & VALUE_TAG_MASK;
 }
 
@@ -100,12 +112,41 @@ static inline value new_number_value(number num) {
 	return ((value) num << 3) | VALUE_TAG_NUMBER;
 }
 
+// Creates a new small string `value` out of the first `length` bytes of `ptr`.
+static inline value new_small_string_value(const char *ptr, unsigned length) {
+	assert(length <= SMALL_STRING_MAX_LENGTH);
+	value val = VALUE_TAG_SMALL_STRING | (length << 3);
+
+	for (unsigned i = 0; i < length; i++)
+		val |= (value) (unsigned char) ptr[i] << (8 * (i + 1));
+
+	return val;
+}
+
 // Creates a new `value` out of a `string`.
+//
+// If `str` is short enough, the returned value is a small string, and our reference to `str` is
+// released.
 static inline value new_string_value(string *str) {
 	assert(((value) str & VALUE_TAG_MASK) == 0); // Sanity check for alignment.
+
+	if (str->length <= SMALL_STRING_MAX_LENGTH) {
+		value val = new_small_string_value(string_ptr(str), str->length);
+		free_string(str);
+		return val;
+	}
+
 	return (value) str | VALUE_TAG_STRING;
 }
 
+// Creates a new string `value` out of the first `length` bytes of `ptr`, only allocating if needed.
+static inline value new_string_value_from_bytes(const char *ptr, unsigned length) {
+	if (length <= SMALL_STRING_MAX_LENGTH)
+		return new_small_string_value(ptr, length);
+
+	return (value) new_string(ptr, length) | VALUE_TAG_STRING;
+}
+
 // Creates a new `value` out of a `function`.
 static inline value new_function_value(function *func) {
 	assert(((value) func & VALUE_TAG_MASK) == 0); // Sanity check for alignment.
@@ -140,6 +181,11 @@ static inline bool is_string(value val) {
 	return classify(val) == VALUE_KIND_STRING;
 }
 
+// Checks if `val` is a string which is packed into the value itself, rather than a `string`.
+static inline bool is_small_string(value val) {
+	return (val & VALUE_TAG_MASK) == VALUE_TAG_SMALL_STRING;
+}
+
 // Checks if `val` is a `function`.
 static inline bool is_function(value val) {
 	return classify(val) == VALUE_KIND_FUNCTION;
@@ -168,12 +214,49 @@ static inline array *as_array(value val) {
 	return (array *) (val & ~VALUE_TAG_MASK);
 }
 
-// Casts `val` to a `string` without verifying its type.
+// Casts `val` to a `string` without verifying its type. Note that small strings aren't `string`s;
+// use `view_string_value` to get the contents of any string value.
 static inline string *as_string(value val) {
-	assert(is_string(val));
+	assert(is_string(val) && !is_small_string(val));
 	return (string *) (val & ~VALUE_TAG_MASK);
 }
 
+// A borrowed view of a string value's contents. For small strings, the contents are unpacked into
+// `buffer`, so views must be passed around by pointer, and not outlive the value they came from.
+typedef struct {
+	const char *ptr;
+	unsigned length;
+	char buffer[SMALL_STRING_MAX_LENGTH];
+} string_view;
+
+// Gets the length of the string `val`, without needing to view it.
+static inline unsigned string_value_length(value val) {
+	return is_small_string(val) ? (val >> 3) & 7 : as_string(val)->length;
+}
+
+// Sets `view` to the contents of the string `val`.
+static inline void view_string_value(value val, string_view *view) {
+	if (!is_small_string(val)) {
+		view->ptr = string_ptr(as_string(val));
+		view->length = as_string(val)->length;
+		return;
+	}
+
+	view->length = string_value_length(val);
+	for (unsigned i = 0; i < view->length; i++)
+		view->buffer[i] = (char) (val >> (8 * (i + 1)));
+	view->ptr = view->buffer;
+}
+
+// Interns the string `val` (see `intern_string`), taking ownership of it. Small strings are already
+// compared by value, so they're returned as-is.
+static inline value intern_string_value(value val) {
+	if (is_small_string(val))
+		return val;
+
+	return new_string_value(intern_string(as_string(val)));
+}
+
 // Casts `val` to a `function` without verifying its type.
 static inline function *as_function(value val) {
 	assert(is_function(val));
@@ -215,6 +298,10 @@ value not_value(value val);
 // Adds `lhs` to `rhs`.
 value add_values(value lhs, value rhs);
 
+// Adds `lhs` to `rhs` like `add_values`, except ownership of `lhs` is passed to this function. This
+// lets uniquely-owned strings and arrays be appended to in place instead of copied.
+value add_values_in_place(value lhs, value rhs);
+
 // Subtracts `rhs` from `lhs`.
 value subtract_values(value lhs, value rhs);
 